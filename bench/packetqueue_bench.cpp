@@ -0,0 +1,149 @@
+/* Contention benchmark of PacketQueue: a producer and a consumer thread pass packets through the
+ * queue while a third thread polls its statistics, like the demuxer, a decoder and the buffering
+ * checks do. The same load runs through a mutex protected std::queue, the previous design.
+ * Usage: packetqueue_bench [packets] */
+
+#include "packetqueue.hpp"
+#include "clock.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <queue>
+#include <thread>
+
+/* the packets passed per batch by the batched variants */
+#define BENCH_BATCH 32
+
+/* std::queue under a mutex, the consumer notified on every put */
+class LockedQueue
+{
+    std::queue<CAVPacket> pkts;
+    int size = 0;
+    double duration = 0.0;
+    mutable std::mutex mutex;
+    std::condition_variable cond;
+
+public:
+    bool put(CAVPacket&& pkt)
+    {
+        {
+            std::scoped_lock lck(mutex);
+            size += pkt.size();
+            duration += pkt.dur();
+            pkts.push(std::move(pkt));
+        }
+        cond.notify_one();
+        return true;
+    }
+
+    int put(CAVPacket* src, int count)
+    {
+        for (int i = 0; i < count; i++)
+            put(std::move(src[i]));
+        return count;
+    }
+
+    int get(CAVPacket& dst, bool)
+    {
+        std::unique_lock lck(mutex);
+        cond.wait(lck, [this]{return !pkts.empty();});
+        dst = std::move(pkts.front());
+        pkts.pop();
+        size -= dst.size();
+        duration -= dst.dur();
+        return 1;
+    }
+
+    int get(std::vector<CAVPacket>& dst, int max_count, bool block)
+    {
+        CAVPacket pkt;
+        get(pkt, block);
+        dst.push_back(std::move(pkt));
+        std::scoped_lock lck(mutex);
+        int taken = 1;
+        for (; taken < max_count && !pkts.empty(); taken++) {
+            size -= pkts.front().size();
+            duration -= pkts.front().dur();
+            dst.push_back(std::move(pkts.front()));
+            pkts.pop();
+        }
+        return taken;
+    }
+
+    std::tuple<int, int, double> getParams() const
+    {
+        std::scoped_lock lck(mutex);
+        return {size, int(pkts.size()), duration};
+    }
+};
+
+/* packets per second through the queue */
+template<typename Queue>
+static double run(Queue& queue, const CAVPacket& proto, int count, bool batched)
+{
+    std::atomic_bool done = false;
+    std::thread poller([&]{
+        while (!done.load())
+            queue.getParams();
+    });
+
+    const double start = gettime();
+    std::thread producer([&]{
+        std::vector<CAVPacket> batch(BENCH_BATCH);
+        for (int sent = 0; sent < count;) {
+            const int n = batched ? std::min(BENCH_BATCH, count - sent) : 1;
+            for (int i = 0; i < n; i++)
+                batch[i] = proto;
+            /* the ring is bounded: a full queue is retried */
+            for (int put = 0; put < n;) {
+                const int ret = batched ? queue.put(batch.data() + put, n - put) : queue.put(std::move(batch[0]));
+                if (ret <= 0)
+                    std::this_thread::yield();
+                put += ret;
+            }
+            sent += n;
+        }
+    });
+
+    std::vector<CAVPacket> got;
+    CAVPacket pkt;
+    for (int received = 0; received < count;) {
+        if (batched) {
+            got.clear();
+            received += queue.get(got, BENCH_BATCH, true);
+        } else {
+            received += queue.get(pkt, true);
+        }
+    }
+    const double elapsed = gettime() - start;
+
+    producer.join();
+    done = true;
+    poller.join();
+    return count / elapsed;
+}
+
+int main(int argc, char **argv)
+{
+    const int count = argc > 1 ? atoi(argv[1]) : 1000000;
+
+    /* the copies share the payload, only the packet structures are allocated */
+    CAVPacket proto;
+    if (av_new_packet(proto.av(), 4096) < 0)
+        return 1;
+    proto.av()->duration = 1;
+    proto.setTb({1, 1000});
+
+    printf("%-12s %-8s %14s\n", "queue", "batch", "packets/s");
+    for (const bool batched : {false, true}) {
+        WakeupEvent wakeup;
+        PacketQueue ring(wakeup);
+        ring.start();
+        printf("%-12s %-8d %14.0f\n", "PacketQueue", batched ? BENCH_BATCH : 1, run(ring, proto, count, batched));
+
+        LockedQueue locked;
+        printf("%-12s %-8d %14.0f\n", "locked", batched ? BENCH_BATCH : 1, run(locked, proto, count, batched));
+    }
+    return 0;
+}
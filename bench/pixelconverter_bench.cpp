@@ -0,0 +1,152 @@
+/* Times PixelConverter, with each of its kernel sets, against swscale converting the same frames
+ * to the same texture formats, at the thread count of the converter.
+ * Usage: pixelconverter_bench [seconds per case] */
+
+#include "pixelconverter.hpp"
+#include "clock.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+extern "C"{
+#include <libavutil/cpu.h>
+#include <libavutil/opt.h>
+#include <libavutil/pixdesc.h>
+#include <libswscale/swscale.h>
+}
+
+/* each case runs for at least this many frames */
+#define BENCH_MIN_FRAMES 10
+
+static AVFrame* make_frame(AVPixelFormat fmt, int w, int h)
+{
+    AVFrame *frame = av_frame_alloc();
+    frame->format = fmt;
+    frame->width = w;
+    frame->height = h;
+    if (av_frame_get_buffer(frame, 0) < 0) {
+        av_frame_free(&frame);
+        return nullptr;
+    }
+
+    /* noise, within the range of the bit depth */
+    std::mt19937 rng(42);
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(fmt);
+    const int depth = desc->comp[0].depth;
+    for (int plane = 0; plane < av_pix_fmt_count_planes(fmt); plane++) {
+        const int ph = (plane == 1 || plane == 2) ? AV_CEIL_RSHIFT(h, desc->log2_chroma_h) : h;
+        for (int y = 0; y < ph; y++) {
+            uint8_t *row = frame->data[plane] + ptrdiff_t(y) * frame->linesize[plane];
+            if (depth > 8) {
+                for (int x = 0; x < frame->linesize[plane] / 2; x++)
+                    ((uint16_t*)row)[x] = uint16_t(rng() & ((1 << depth) - 1));
+            } else {
+                for (int x = 0; x < frame->linesize[plane]; x++)
+                    row[x] = uint8_t(rng());
+            }
+        }
+    }
+    return frame;
+}
+
+/* average time per frame of convert(), in seconds */
+template<typename Convert>
+static double time_frames(double min_time, Convert&& convert)
+{
+    convert(); /*warm up: buffer pools, caches*/
+    int frames = 0;
+    const double start = gettime();
+    double elapsed = 0.0;
+    while (frames < BENCH_MIN_FRAMES || elapsed < min_time) {
+        if (convert() < 0)
+            return NAN;
+        frames++;
+        elapsed = gettime() - start;
+    }
+    return elapsed / frames;
+}
+
+static double time_swscale(const AVFrame *src, AVPixelFormat dst_fmt, int threads, double min_time)
+{
+    SwsContext *sws = sws_alloc_context();
+    av_opt_set_int(sws, "srcw", src->width, 0);
+    av_opt_set_int(sws, "srch", src->height, 0);
+    av_opt_set_int(sws, "src_format", src->format, 0);
+    av_opt_set_int(sws, "dstw", src->width, 0);
+    av_opt_set_int(sws, "dsth", src->height, 0);
+    av_opt_set_int(sws, "dst_format", dst_fmt, 0);
+    av_opt_set_int(sws, "sws_flags", SWS_BICUBIC, 0);
+    av_opt_set_int(sws, "threads", threads, 0);
+    if (sws_init_context(sws, nullptr, nullptr) < 0) {
+        sws_freeContext(sws);
+        return NAN;
+    }
+
+    AVFrame *dst = av_frame_alloc();
+    dst->format = dst_fmt;
+    dst->width = src->width;
+    dst->height = src->height;
+    double t = NAN;
+    if (av_frame_get_buffer(dst, 0) >= 0)
+        t = time_frames(min_time, [&]{return sws_scale_frame(sws, dst, src);});
+    av_frame_free(&dst);
+    sws_freeContext(sws);
+    return t;
+}
+
+int main(int argc, char **argv)
+{
+    const double min_time = argc > 1 ? atof(argv[1]) : 1.0;
+    av_log_set_level(AV_LOG_ERROR);
+
+    /* the texture formats the renderers usually have */
+    const std::vector<AVPixelFormat> supported = {AV_PIX_FMT_YUV420P, AV_PIX_FMT_NV12, AV_PIX_FMT_P010, AV_PIX_FMT_0RGB32};
+    const AVPixelFormat formats[] = {AV_PIX_FMT_YUV422P, AV_PIX_FMT_YUV444P, AV_PIX_FMT_YUV420P10LE, AV_PIX_FMT_GBRP};
+    const struct {int w, h;} sizes[] = {{1920, 1080}, {3840, 2160}};
+
+    /* the kernel sets the CPU can run */
+    const int cpu = av_get_cpu_flags();
+    std::vector<int> kernel_flags = {0};
+    if (cpu & AV_CPU_FLAG_SSE2)
+        kernel_flags.push_back(AV_CPU_FLAG_SSE2);
+    if ((cpu & AV_CPU_FLAG_SSE2) && (cpu & AV_CPU_FLAG_AVX2))
+        kernel_flags.push_back(AV_CPU_FLAG_SSE2 | AV_CPU_FLAG_AVX2);
+
+    printf("%-14s %-10s %-8s %-10s %10s %10s\n", "source", "size", "target", "impl", "ms/frame", "vs sws");
+    for (const auto fmt : formats) {
+        const auto dst_fmt = PixelConverter::outputFormat(fmt, supported);
+        for (const auto& size : sizes) {
+            AVFrame *src = make_frame(fmt, size.w, size.h);
+            AVFrame *dst = av_frame_alloc();
+            if (!src || !dst || dst_fmt == AV_PIX_FMT_NONE) {
+                fprintf(stderr, "can't set up %s\n", av_get_pix_fmt_name(fmt));
+                return 1;
+            }
+            char size_str[32];
+            snprintf(size_str, sizeof(size_str), "%dx%d", size.w, size.h);
+
+            int threads = 1;
+            std::vector<std::pair<const char*, double>> results;
+            for (const int flags : kernel_flags) {
+                PixelConverter conv(flags);
+                threads = conv.threadCount();
+                results.emplace_back(conv.kernelName(),
+                                     time_frames(min_time, [&]{return conv.convert(src, dst, dst_fmt);}));
+            }
+            const double sws = time_swscale(src, dst_fmt, threads, min_time);
+
+            for (const auto& [name, t] : results)
+                printf("%-14s %-10s %-8s %-10s %10.3f %9.2fx\n", av_get_pix_fmt_name(fmt), size_str,
+                       av_get_pix_fmt_name(dst_fmt), name, t * 1000.0, sws / t);
+            char sws_name[32];
+            snprintf(sws_name, sizeof(sws_name), "swscale/%d", threads);
+            printf("%-14s %-10s %-8s %-10s %10.3f %9.2fx\n", av_get_pix_fmt_name(fmt), size_str,
+                   av_get_pix_fmt_name(dst_fmt), sws_name, sws * 1000.0, 1.0);
+
+            av_frame_free(&dst);
+            av_frame_free(&src);
+        }
+    }
+    return 0;
+}
@@ -66,6 +66,10 @@ MainWindow::MainWindow(QWidget *parent)
 
     connect(m_menus, &MenuBarMenu::stopPlayback, core, &PlayerCore::stopPlayback);
     connect(tBar, &ToolBar::sigSeek, core, &PlayerCore::requestSeekPercent);
+    connect(tBar, &ToolBar::sigScrub, core, &PlayerCore::requestScrub);
+    connect(tBar, &ToolBar::sigScrubEnd, core, &PlayerCore::endScrub);
+    connect(tBar, &ToolBar::sigThumbnailRequest, core, &PlayerCore::requestThumbnail);
+    connect(core, &PlayerCore::thumbnailReady, tBar, &ToolBar::showThumbnail);
     connect(core, &PlayerCore::updatePlaybackPos, tBar, &ToolBar::updatePlaybackPos);
     connect(core, &PlayerCore::updatePlaybackPos, sBar, &StatusBar::updatePlaybackPos);
     connect(core, &PlayerCore::setControlsActive, tBar, &ToolBar::setActive);
@@ -1,8 +1,26 @@
 #include "audiooutput.hpp"
+#include "clock.hpp"
 
 #include <SDL3/SDL.h>
 
-AudioOutput::AudioOutput() {
+#include <stdexcept>
+#include <algorithm>
+
+extern "C"{
+#include <libavutil/log.h>
+}
+
+/* the ring holds this much audio on top of the largest buffer duration, for the frames written while below it */
+#define AUDIO_RING_MARGIN 1.0
+/* the buffer duration grows by this factor on an underrun. It shrinks by the other one after
+ * AUDIO_BUFFER_SHRINK_AFTER seconds without underruns, if the ring stayed above half of it */
+#define AUDIO_BUFFER_GROW 1.5
+#define AUDIO_BUFFER_SHRINK 0.9
+#define AUDIO_BUFFER_SHRINK_AFTER 10.0
+
+AudioOutput::AudioOutput(double buffer_s, double min_s, double max_s) :
+    buffer_min(min_s), buffer_max(std::max(min_s, max_s)), buffer_duration(std::clamp(buffer_s, buffer_min, buffer_max)),
+    buffer_peak(buffer_duration) {
     if(!SDL_WasInit(SDL_INIT_AUDIO)){
         throw std::runtime_error("SDL audio subsistem was not initialized(somehow!)");
     }
@@ -30,49 +48,162 @@ void AudioOutput::setVolume(float vol){
 }
 
 void AudioOutput::setPauseStatus(bool pause_status){
-    if(astream && pause_status != paused){
+    std::scoped_lock lck(ao_mtx);
+    if(pause_status != paused){
         paused = pause_status;
+        if(!astream)
+            return;
         if(paused)
-            SDL_ResumeAudioStreamDevice(astream);
-        else
             SDL_PauseAudioStreamDevice(astream);
+        else
+            SDL_ResumeAudioStreamDevice(astream);
     }
 }
 
 void AudioOutput::flushBuffers(){
-    if(astream){
-        SDL_ClearAudioStream(astream);
-    }
+    ring.flush();
 }
 
-bool AudioOutput::sendData(const uint8_t* src, size_t byte_len, bool final){
-    if(!astream) return false;
-    bool success = SDL_PutAudioStreamData(astream, src, byte_len);
-    if(final)
-        success |= SDL_FlushAudioStream(astream);
-    return success;
+bool AudioOutput::write(const uint8_t* src, size_t byte_len, double pts, int serial){
+    if(!astream || ring.space() < byte_len) return false;
+    ring.addMark(pts, serial);
+    ring.write(src, byte_len);
+    return true;
 }
 
-double AudioOutput::getLatency() const{
-    double latency = 0.0;
-    if(astream){
-        const auto bytes_queued = SDL_GetAudioStreamQueued(astream);
-        latency = double(bytes_queued) / bitrate();
+bool AudioOutput::wantsData() const{
+    return astream && ring.filled() < buffer_bytes();
+}
+
+void AudioOutput::waitForRoom(double timeout){
+    room_event.waitFor(timeout);
+}
+
+void AudioOutput::setSourceReady(bool ready){
+    source_dry = !ready;
+}
+
+void AudioOutput::adaptBuffer(){
+    /*the feeder thread reopens the stream under it*/
+    std::scoped_lock lck(ao_mtx);
+    if(!astream)
+        return;
+    fill_sum += latency();
+    ++fill_samples;
+    if(buffer_min >= buffer_max)
+        return;
+    const double time = gettime();
+    const int count = underruns.load();
+    const size_t low = low_fill.exchange(SIZE_MAX);
+    double duration = buffer_duration.load();
+    if(count != adapted_underruns){
+        adapted_underruns = count;
+        duration = std::min(duration * AUDIO_BUFFER_GROW, buffer_max);
+        stable_since = time;
+        stable_low_fill = SIZE_MAX;
+    } else{
+        stable_low_fill = std::min(stable_low_fill, low);
+        if(isnan(stable_since))
+            stable_since = time;
+        if(time - stable_since < AUDIO_BUFFER_SHRINK_AFTER)
+            return;
+        /*the callback didn't run at all if the device was paused*/
+        if(stable_low_fill != SIZE_MAX && stable_low_fill > buffer_bytes() / 2)
+            duration = std::max(duration * AUDIO_BUFFER_SHRINK, buffer_min);
+        stable_since = time;
+        stable_low_fill = SIZE_MAX;
     }
+    if(duration != buffer_duration.load()){
+        av_log(NULL, AV_LOG_VERBOSE, "Audio output buffer %s to %.0f ms\n",
+               duration > buffer_duration.load() ? "grown" : "shrunk", duration * 1000.0);
+        buffer_duration = duration;
+        buffer_peak = std::max(buffer_peak, duration);
+    }
+}
 
-    return latency;
+double AudioOutput::bufferDuration() const{
+    return buffer_duration;
 }
 
-static SDL_AudioStream* audio_open(int wanted_nb_channels, int wanted_sample_rate)
-{
-    const SDL_AudioSpec spec{.format = SDL_AUDIO_F32, .channels = wanted_nb_channels, .freq = wanted_sample_rate};
-    const auto astream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, nullptr, nullptr);
+size_t AudioOutput::buffer_bytes() const{
+    return size_t(buffer_duration * rate()) * channels() * sizeof(float);
+}
+
+void SDLCALL AudioOutput::audio_callback(void* userdata, SDL_AudioStream* stream, int additional_amount, int total_amount){
+    static_cast<AudioOutput*>(userdata)->pull(stream, additional_amount);
+}
 
-    if (astream) {
-        SDL_ResumeAudioStreamDevice(astream);
+/* Runs on the thread of the device: never blocks, and what it can't get from the ring is left as silence */
+void AudioOutput::pull(SDL_AudioStream* stream, int len){
+    const int frame_size = channels() * sizeof(float);
+    if(len <= 0 || frame_size <= 0)
+        return;
+    len -= len % frame_size;
+    const size_t got = ring.consume(len, [stream](const uint8_t* data, size_t size){
+        SDL_PutAudioStreamData(stream, data, int(size));
+    });
+    /*an empty ring only counts once it played, not before the first samples*/
+    if(got < size_t(len)){
+        if(!starved)
+            ++(source_dry ? starvations : underruns);
+        starved = true;
+    } else{
+        starved = false;
     }
+    const size_t filled = ring.filled();
+    if(filled < low_fill.load(std::memory_order_relaxed))
+        low_fill.store(filled, std::memory_order_relaxed);
+    if(filled < buffer_bytes())
+        room_event.signal();
 
-    return astream;
+    /*the device has yet to pull what is still queued in the stream*/
+    const uint64_t queued = std::max(SDL_GetAudioStreamQueued(stream), 0);
+    const uint64_t pos = ring.readPos() - std::min(queued, ring.readPos());
+    const auto mark = ring.markAt(pos);
+    if(!isnan(mark.pts) && clock_mutex.try_lock()){
+        played = {mark.pts + double(pos - mark.pos) / bitrate() - device_latency, gettime(), mark.serial};
+        clock_mutex.unlock();
+    }
+}
+
+double AudioOutput::latency() const{
+    if(!astream)
+        return 0.0;
+    const auto bytes_queued = SDL_GetAudioStreamQueued(astream) + ring.filled();
+    return double(bytes_queued) / bitrate();
+}
+
+double AudioOutput::getLatency() const{
+    std::scoped_lock lck(ao_mtx);
+    return latency();
+}
+
+double AudioOutput::averageLatency() const{
+    std::scoped_lock lck(ao_mtx);
+    return fill_samples ? fill_sum / fill_samples : 0.0;
+}
+
+AudioOutput::PlayedClock AudioOutput::playedClock(){
+    std::scoped_lock lck(clock_mutex);
+    return played;
+}
+
+int AudioOutput::underrunCount() const{
+    return underruns;
+}
+
+int AudioOutput::starvationCount() const{
+    return starvations;
+}
+
+double AudioOutput::peakBufferDuration() const{
+    return buffer_peak;
+}
+
+static SDL_AudioStream* audio_open(int wanted_nb_channels, int wanted_sample_rate, SDL_AudioStreamCallback cb, void* userdata)
+{
+    const SDL_AudioSpec spec{.format = SDL_AUDIO_F32, .channels = wanted_nb_channels, .freq = wanted_sample_rate};
+    return SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &spec, cb, userdata);
 }
 
 bool AudioOutput::maybeHandleChange(){
@@ -87,18 +218,33 @@ bool AudioOutput::maybeHandleChange(){
             SDL_DestroyAudioStream(astream);
             astream = nullptr;
             ao_rate = ao_channels = 0;
-            paused = false;
             if(rate <= 0 && chn <= 0){
                 return true;
             }
         }
 
         if(rate > 0 && chn > 0){
-            if((astream = audio_open(chn, rate))){
-                ao_rate = rate;
-                ao_channels = chn;
+            /*the callback is gone with the previous stream, nothing reads the ring*/
+            ring.reset(size_t((buffer_max + AUDIO_RING_MARGIN) * rate) * chn * sizeof(float));
+            {
+                std::scoped_lock clck(clock_mutex);
+                played = {};
+            }
+            ao_rate = rate;
+            ao_channels = chn;
+            if((astream = audio_open(chn, rate, audio_callback, this))){
+                /*the device plays a period while the callback fills the next one*/
+                SDL_AudioSpec dev_spec{};
+                int dev_frames = 0;
+                device_latency = 0.0;
+                if(SDL_GetAudioDeviceFormat(SDL_GetAudioStreamDevice(astream), &dev_spec, &dev_frames) && dev_spec.freq > 0)
+                    device_latency = double(dev_frames) / dev_spec.freq;
+                SDL_SetAudioStreamGain(astream, volume);
+                if(!paused)
+                    SDL_ResumeAudioStreamDevice(astream);
                 return true;
             }
+            ao_rate = ao_channels = 0;
         }
     }
 
@@ -2,25 +2,66 @@
 #define AUDIOOUTPUT_HPP
 
 #include <mutex>
+#include <atomic>
 
 #include <QtGlobal>
 
+#include "audioring.hpp"
+#include "wakeupevent.hpp"
+
 /* A simple audio output based on SDL3. It can accept any sample rate and channel count since
  * SDL_AudioStream can manage these conversions internally, but the samples ought to always be in
- * the Float32 interleaved format. */
+ * the Float32 interleaved format.
+ * The device pulls the samples from a callback, out of a small ring filled by the feeder thread,
+ * so the audio doesn't depend on any other thread keeping up. */
 class AudioOutput final
 {
     Q_DISABLE_COPY_MOVE(AudioOutput);
+public:
+    /*The timestamp of what the device got last, and when*/
+    struct PlayedClock {
+        double pts = NAN;
+        double time = NAN;
+        int serial = -1;
+    };
+
 private:
     struct SDL_AudioStream* astream = nullptr;
-    std::mutex ao_mtx;
+    mutable std::mutex ao_mtx;
     bool change_req = false;
     int ao_rate = 0, ao_channels = 0, req_rate = 0, req_channels = 0;
     float volume = 1.0;
     bool muted = false, paused = false;
 
+    const double buffer_min, buffer_max;
+    std::atomic<double> buffer_duration; /*adapted by adaptBuffer()*/
+    AudioRing ring;
+    WakeupEvent room_event; /*signalled by the callback once the ring drops below the buffer duration*/
+    std::mutex clock_mutex; /*only tried by the callback, which skips the update rather than wait*/
+    PlayedClock played;
+    double device_latency = 0.0; /*between the callback and the speakers*/
+    /*written by the callback only. The starvations are the underruns while the feeder had no frames*/
+    std::atomic<int> underruns = 0, starvations = 0;
+    bool starved = true;
+    std::atomic_bool source_dry = true;
+    std::atomic<size_t> low_fill = SIZE_MAX; /*the lowest the ring got since the last adaptBuffer()*/
+
+    /*the state of adaptBuffer()*/
+    int adapted_underruns = 0;
+    double stable_since = NAN;
+    size_t stable_low_fill = SIZE_MAX;
+    double buffer_peak = 0.0;
+    double fill_sum = 0.0;
+    int fill_samples = 0;
+
+    static void SDLCALL audio_callback(void* userdata, struct SDL_AudioStream* stream, int additional_amount, int total_amount);
+    void pull(struct SDL_AudioStream* stream, int len);
+    size_t buffer_bytes() const;
+    double latency() const; /*under ao_mtx*/
+
 public:
-    AudioOutput();
+    /*buffer_duration: the audio kept ready for the device, in seconds, adapted between min_duration and max_duration*/
+    AudioOutput(double buffer_duration, double min_duration, double max_duration);
     ~AudioOutput();
 
     /*Requests a change for audio output. If either rate or
@@ -30,8 +71,33 @@ public:
     int channels() const;
     void setVolume(float vol);
     void setPauseStatus(bool paused);
+    /*Drops the samples not played yet, from the feeder thread*/
     void flushBuffers();
-    bool sendData(const uint8_t* src, size_t byte_len, bool final);
+    /*From the feeder thread: queues the samples, pts being the timestamp of the first one. Returns
+     * false, writing nothing, if they don't fit yet*/
+    bool write(const uint8_t* src, size_t byte_len, double pts, int serial);
+    /*Same as write(), but fill(dst, offset, size) produces the bytes offset to offset + size of the
+     * byte_len ones right into the ring*/
+    template<typename Fill>
+    bool writeWith(size_t byte_len, double pts, int serial, Fill&& fill)
+    {
+        if(!astream || ring.space() < byte_len) return false;
+        ring.addMark(pts, serial);
+        ring.writeWith(byte_len, fill);
+        return true;
+    }
+    double bufferDuration() const;
+    /*True while less than the buffer duration is queued*/
+    bool wantsData() const;
+    /*From the feeder thread: whether it has the frames to keep the buffer filled. The underruns without
+     * them are the decoder's, not the output's, they don't grow the buffer*/
+    void setSourceReady(bool ready);
+    /*Grows the buffer duration after the underruns, and shrinks it back after a while without any
+     * where the ring never went below half of it. Call periodically while playing, it samples the
+     * buffered duration for averageLatency() as well*/
+    void adaptBuffer();
+    /*Sleeps until the device consumed some samples, or for timeout seconds at most*/
+    void waitForRoom(double timeout);
     bool forceReopen();
     /*Returns true if there was a change*/
     bool maybeHandleChange();
@@ -40,6 +106,14 @@ public:
 
     /*returns the buffered duration in seconds*/
     double getLatency() const;
+    /*Accounts for the buffering of the stream and of the device*/
+    PlayedClock playedClock();
+    int underrunCount() const;
+    int starvationCount() const;
+    /*the largest buffer duration adaptBuffer() went to*/
+    double peakBufferDuration() const;
+    /*the buffered duration on average, over the calls to adaptBuffer()*/
+    double averageLatency() const;
 
 };
 
@@ -1,5 +1,78 @@
 #include "audioresampler.hpp"
 
+#include <cstring>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define AUDIO_SSE 1
+#include <xmmintrin.h>
+#else
+#define AUDIO_SSE 0
+#endif
+
+/* Interleaves count sample frames of the float planes, from the sample s. The channels are
+ * transposed by groups of four, four samples at a time */
+static void interleave_frames(const float* const* planes, int ch, size_t s, size_t count, float* dst)
+{
+    if (ch == 1) {
+        memcpy(dst, planes[0] + s, count * sizeof(float));
+        return;
+    }
+
+    size_t i = 0;
+#if AUDIO_SSE
+    if (ch == 2) {
+        const float *l = planes[0] + s, *r = planes[1] + s;
+        for (; i + 4 <= count; i += 4) {
+            const __m128 a = _mm_loadu_ps(l + i), b = _mm_loadu_ps(r + i);
+            _mm_storeu_ps(dst + 2 * i, _mm_unpacklo_ps(a, b));
+            _mm_storeu_ps(dst + 2 * i + 4, _mm_unpackhi_ps(a, b));
+        }
+    } else if (ch >= 4) {
+        const int groups = ch / 4;
+        for (; i + 4 <= count; i += 4) {
+            float *out = dst + i * ch;
+            for (int g = 0; g < groups; g++) {
+                __m128 r0 = _mm_loadu_ps(planes[4 * g] + s + i), r1 = _mm_loadu_ps(planes[4 * g + 1] + s + i);
+                __m128 r2 = _mm_loadu_ps(planes[4 * g + 2] + s + i), r3 = _mm_loadu_ps(planes[4 * g + 3] + s + i);
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                _mm_storeu_ps(out + 4 * g, r0);
+                _mm_storeu_ps(out + ch + 4 * g, r1);
+                _mm_storeu_ps(out + 2 * ch + 4 * g, r2);
+                _mm_storeu_ps(out + 3 * ch + 4 * g, r3);
+            }
+            for (int c = 4 * groups; c < ch; c++) {
+                for (int j = 0; j < 4; j++)
+                    out[j * ch + c] = planes[c][s + i + j];
+            }
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        for (int c = 0; c < ch; c++)
+            dst[i * ch + c] = planes[c][s + i];
+    }
+}
+
+/* The n interleaved samples starting at the index k, which may begin and end within a sample frame */
+static void interleave_range(const float* const* planes, int ch, size_t k, size_t n, float* dst)
+{
+    size_t s = k / ch;
+    int c = int(k % ch);
+    for (; n && c; --n) {
+        *dst++ = planes[c][s];
+        if (++c == ch) {
+            c = 0;
+            ++s;
+        }
+    }
+    const size_t frames = n / ch;
+    interleave_frames(planes, ch, s, frames, dst);
+    dst += frames * ch;
+    s += frames;
+    for (n -= frames * ch; n; --n)
+        *dst++ = planes[c++][s];
+}
+
 AudioResampler::AudioResampler() {}
 AudioResampler::~AudioResampler(){
     if(swr_ctx){
@@ -13,7 +86,26 @@ void AudioResampler::setOutputFmt(int rate, const CAVChannelLayout& lout, AVSamp
     out_fmt = fmt;
 }
 
-bool AudioResampler::convert(AVFrameView aframe, std::vector<uint8_t>& dst, int wanted_nb_samples, bool final){
+bool AudioResampler::isPassthrough(AVFrameView aframe) const{
+    return !stretched && out_fmt == AV_SAMPLE_FMT_FLT && aframe.sampleRate() == out_rate
+           && (aframe.sampleFmt() == AV_SAMPLE_FMT_FLT || aframe.sampleFmt() == AV_SAMPLE_FMT_FLTP)
+           && !av_channel_layout_compare(&out_ch_layout.constAv(), &aframe.chLayout());
+}
+
+size_t AudioResampler::passthroughSize(AVFrameView aframe){
+    return size_t(aframe.nbSamples()) * aframe.chCount() * sizeof(float);
+}
+
+void AudioResampler::interleave(AVFrameView aframe, size_t offset, size_t len, uint8_t* dst){
+    if (aframe.sampleFmt() == AV_SAMPLE_FMT_FLT || aframe.chCount() == 1) {
+        memcpy(dst, aframe.extData()[0] + offset, len);
+        return;
+    }
+    interleave_range(reinterpret_cast<const float* const*>(aframe.extData()), aframe.chCount(),
+                     offset / sizeof(float), len / sizeof(float), reinterpret_cast<float*>(dst));
+}
+
+int AudioResampler::convert(AVFrameView aframe, std::vector<uint8_t>& dst, int wanted_nb_samples, bool final){
     if (aframe.sampleFmt() != src_fmt || src_ch_layout != aframe.chLayout() ||
         aframe.sampleRate() != src_rate || (wanted_nb_samples != aframe.nbSamples() && !swr_ctx)) {
         swr_free(&swr_ctx);
@@ -25,11 +117,12 @@ bool AudioResampler::convert(AVFrameView aframe, std::vector<uint8_t>& dst, int
                    aframe.sampleRate(), av_get_sample_fmt_name(aframe.sampleFmt()), aframe.chCount(),
                    out_rate, av_get_sample_fmt_name(out_fmt), out_ch_layout.nbChannels());
             swr_free(&swr_ctx);
-            return false;
+            return -1;
         }
         src_ch_layout = aframe.chLayout();
         src_rate = aframe.sampleRate();
         src_fmt = aframe.sampleFmt();
+        stretched = false;
     }
 
     if (swr_ctx) {
@@ -37,34 +130,38 @@ bool AudioResampler::convert(AVFrameView aframe, std::vector<uint8_t>& dst, int
         const int out_size  = av_samples_get_buffer_size(NULL, out_ch_layout.nbChannels(), out_count, out_fmt, 0);
         if (out_size < 0) {
             av_log(NULL, AV_LOG_ERROR, "av_samples_get_buffer_size() failed\n");
-            return false;
+            return -1;
         }
         if (wanted_nb_samples != aframe.nbSamples()) {
             if (swr_set_compensation(swr_ctx, (wanted_nb_samples - aframe.nbSamples()) * out_rate / aframe.sampleRate(),
                                      wanted_nb_samples * out_rate / aframe.sampleRate()) < 0) {
                 av_log(NULL, AV_LOG_ERROR, "swr_set_compensation() failed\n");
-                return false;
+                return -1;
             }
+            stretched = true;
         }
-        dst.resize(out_size);
+        if (int(dst.size()) < out_size)
+            dst.resize(out_size);
         uint8_t* out[] = {dst.data()};
         const auto len2 = swr_convert(swr_ctx, out, out_count, aframe.extData(), aframe.nbSamples());
         if (len2 < 0) {
             av_log(NULL, AV_LOG_ERROR, "swr_convert() failed\n");
-            return false;
+            return -1;
         } else if (len2 == out_count) {
             av_log(NULL, AV_LOG_WARNING, "audio buffer is probably too small\n");
             if (swr_init(swr_ctx) < 0)
                 swr_free(&swr_ctx);
         }
 
-        const auto resampled_data_size = len2 * out_ch_layout.nbChannels() * av_get_bytes_per_sample(out_fmt);
-        dst.resize(resampled_data_size);
+        return len2 * out_ch_layout.nbChannels() * av_get_bytes_per_sample(out_fmt);
     } else {
         const auto data_size = av_samples_get_buffer_size(NULL, aframe.chCount(),
                                 aframe.nbSamples(), aframe.sampleFmt(), 1);
-        dst.resize(data_size);
-        std::copy(aframe.constDataPlane(0), aframe.constDataPlane(0) + data_size, dst.begin());
+        if (data_size < 0)
+            return data_size;
+        if (int(dst.size()) < data_size)
+            dst.resize(data_size);
+        memcpy(dst.data(), aframe.constDataPlane(0), data_size);
+        return data_size;
     }
-    return true;
 }
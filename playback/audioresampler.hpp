@@ -21,6 +21,7 @@ private:
     CAVChannelLayout out_ch_layout, src_ch_layout;
 
     SwrContext* swr_ctx = nullptr;
+    bool stretched = false; /*swr_ctx compensated, its delay would be lost by a switch to the passthrough*/
 
 public:
     AudioResampler();
@@ -28,9 +29,18 @@ public:
 
     void setOutputFmt(int out_rate, const CAVChannelLayout& out_lout, AVSampleFormat out_fmt);
 
-    /*Converts aframe and puts the converted data into dst
-     @param aframe - frame to convert*/
-    bool convert(AVFrameView aframe, std::vector<uint8_t>& dst, int wanted_nb_samples, bool final);
+    /*Converts aframe and puts the converted data into dst, which only grows
+     @param aframe - frame to convert
+     @return the size of the converted data in bytes, negative on error*/
+    int convert(AVFrameView aframe, std::vector<uint8_t>& dst, int wanted_nb_samples, bool final);
+
+    /*True if aframe is already at the output rate and layout, in float samples: it only has to be
+     * interleaved(or copied), which interleave() does instead of swresample. Not once the frames of
+     * this format were stretched by convert()*/
+    bool isPassthrough(AVFrameView aframe) const;
+    static size_t passthroughSize(AVFrameView aframe);
+    /*Writes the bytes offset to offset + len of the interleaved samples of aframe to dst*/
+    static void interleave(AVFrameView aframe, size_t offset, size_t len, uint8_t* dst);
 };
 
 #endif // AUDIORESAMPLER_HPP
@@ -0,0 +1,136 @@
+#ifndef AUDIORING_HPP
+#define AUDIORING_HPP
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+#include <QtGlobal>
+
+/* Single-producer/single-consumer ring of converted samples between the audio feeder thread
+ * (write, flush, addMark) and the audio callback(consume, markAt). The positions are absolute byte
+ * counts, so neither side ever waits for the other: the consumer only moves read_pos, the producer
+ * only write_pos and discard_pos.
+ * The marks map the positions to the timestamps of the frames written there, for the audio clock. */
+class AudioRing final
+{
+    Q_DISABLE_COPY_MOVE(AudioRing);
+public:
+    struct Mark {
+        uint64_t pos = 0;
+        double pts = NAN;
+        int serial = -1;
+    };
+
+private:
+    static constexpr int MAX_MARKS = 64;
+
+    std::vector<uint8_t> buf;
+    uint64_t mask = 0;
+    std::atomic<uint64_t> write_pos = 0, read_pos = 0;
+    std::atomic<uint64_t> discard_pos = 0; /*the consumer skips everything before it*/
+
+    Mark marks[MAX_MARKS];
+    std::atomic<int> mark_w = 0, mark_r = 0;
+    Mark last_mark; /*the last one the consumer passed*/
+
+public:
+    AudioRing() = default;
+
+    /*Not thread safe, while neither side runs*/
+    void reset(size_t min_capacity)
+    {
+        size_t capacity = 1;
+        while (capacity < min_capacity)
+            capacity <<= 1;
+        buf.assign(capacity, 0);
+        mask = capacity - 1;
+        write_pos = read_pos = discard_pos = 0;
+        mark_w = mark_r = 0;
+        last_mark = {};
+    }
+
+    size_t capacity() const {return buf.size();}
+    size_t filled() const
+    {
+        const uint64_t r = std::max(read_pos.load(), discard_pos.load());
+        const uint64_t w = write_pos.load();
+        return w > r ? size_t(w - r) : 0;
+    }
+
+    /*producer: what can be written. The flushed bytes only become free once the consumer skipped them*/
+    size_t space() const
+    {
+        return capacity() - size_t(write_pos.load(std::memory_order_relaxed) - read_pos.load(std::memory_order_acquire));
+    }
+
+    /*producer: fill(dst, offset, size) writes the bytes offset to offset + size of the len ones in place,
+     * in at most two calls. len must not exceed space()*/
+    template<typename Fill>
+    void writeWith(size_t len, Fill&& fill)
+    {
+        const uint64_t w = write_pos.load(std::memory_order_relaxed);
+        const size_t off = size_t(w & mask), first = std::min(len, capacity() - off);
+        if (first)
+            fill(buf.data() + off, size_t(0), first);
+        if (len > first)
+            fill(buf.data(), first, len - first);
+        write_pos.store(w + len, std::memory_order_release);
+    }
+
+    size_t write(const uint8_t* src, size_t len)
+    {
+        len = std::min(len, space());
+        writeWith(len, [src](uint8_t* dst, size_t offset, size_t size){memcpy(dst, src + offset, size);});
+        return len;
+    }
+
+    /*the timestamp of the next byte written, dropped if the consumer is too far behind*/
+    void addMark(double pts, int serial)
+    {
+        const int w = mark_w.load(std::memory_order_relaxed);
+        if (w - mark_r.load(std::memory_order_acquire) >= MAX_MARKS)
+            return;
+        marks[w % MAX_MARKS] = {write_pos.load(std::memory_order_relaxed), pts, serial};
+        mark_w.store(w + 1, std::memory_order_release);
+    }
+
+    void flush()
+    {
+        discard_pos.store(write_pos.load(std::memory_order_relaxed), std::memory_order_release);
+    }
+
+    /*consumer: passes up to len bytes to sink(data, size) in at most two chunks, returns the count*/
+    template<typename Sink>
+    size_t consume(size_t len, Sink&& sink)
+    {
+        uint64_t r = std::max(read_pos.load(std::memory_order_relaxed), discard_pos.load(std::memory_order_acquire));
+        const uint64_t w = write_pos.load(std::memory_order_acquire);
+        len = std::min(len, size_t(w - r));
+        const size_t off = size_t(r & mask), first = std::min(len, capacity() - off);
+        if (first)
+            sink(buf.data() + off, first);
+        if (len > first)
+            sink(buf.data(), len - first);
+        read_pos.store(r + len, std::memory_order_release);
+        return len;
+    }
+
+    uint64_t readPos() const {return read_pos.load(std::memory_order_relaxed);}
+
+    /*consumer: the last mark at or before pos, the ones before it are released*/
+    Mark markAt(uint64_t pos)
+    {
+        int r = mark_r.load(std::memory_order_relaxed);
+        const int w = mark_w.load(std::memory_order_acquire);
+        while (r != w && marks[r % MAX_MARKS].pos <= pos)
+            last_mark = marks[r++ % MAX_MARKS];
+        mark_r.store(r, std::memory_order_release);
+        return last_mark;
+    }
+};
+
+#endif // AUDIORING_HPP
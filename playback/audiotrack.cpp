@@ -1,13 +1,23 @@
 #include "audiotrack.hpp"
 
+#include <algorithm>
+
+/* the played position corrects the clock by this fraction of the error, and its speed by this
+ * fraction of the error per update. An error above the maximum is a discontinuity, the clock jumps */
+#define AUDIO_CLOCK_GAIN 0.1
+#define AUDIO_CLOCK_DRIFT_GAIN 0.005
+#define AUDIO_CLOCK_MAX_DRIFT 0.005
+#define AUDIO_CLOCK_MAX_ERROR 0.1
+
 extern "C"{
 #include <libavutil/bprint.h>
 #include <libavutil/opt.h>
+#include <libavutil/samplefmt.h>
 #include <libavfilter/buffersink.h>
 #include <libavfilter/buffersrc.h>
 }
 
-AudioTrack::AudioTrack(const CAVStream& st, std::condition_variable& cond) : AVTrack(st, cond), frame_pool(pkts, SAMPLE_QUEUE_SIZE, 1) {
+AudioTrack::AudioTrack(const CAVStream& st, WakeupEvent& demux_wakeup) : AVTrack(st, demux_wakeup), frame_pool(pkts, SAMPLE_QUEUE_SIZE, 1) {
     dec.decoder_thr = std::thread(&AudioTrack::run, this);
 }
 
@@ -31,6 +41,7 @@ CAVFrame* AudioTrack::getFrame(){
         frame_pool.next();
     } while (af->serial() != serial());
 
+    last_pos = af->pktPos();
     return af;
 }
 
@@ -39,24 +50,45 @@ void AudioTrack::nextFrame(){
 }
 
 int64_t AudioTrack::lastPos(){
-    return frame_pool.last_pos();
+    return last_pos;
 }
 
 double AudioTrack::getClockVal() const{
     return clk.get();
 }
 
-void AudioTrack::updateClock(double pts){
-    clk.set(pts);
+/* The played positions come in bursts, one per period of the device, and jitter with the scheduling
+ * of its thread. The clock follows them with a second order loop: the error corrects the value a
+ * fraction at a time, and the speed absorbs the drift between the device and the system clock */
+void AudioTrack::updateClock(double pts, double time){
+    const double err = pts - clk.getAt(time);
+    if (isnan(err) || fabs(err) > AUDIO_CLOCK_MAX_ERROR) {
+        clock_drift = 0.0;
+        clk.set_speed(1.0);
+        clk.setAt(pts, time);
+        ++clock_resets;
+        return;
+    }
+    clock_drift = std::clamp(clock_drift + err * AUDIO_CLOCK_DRIFT_GAIN, -AUDIO_CLOCK_MAX_DRIFT, AUDIO_CLOCK_MAX_DRIFT);
+    const double corrected = clk.getAt(time) + err * AUDIO_CLOCK_GAIN;
+    clk.set_speed(1.0 + clock_drift);
+    clk.setAt(corrected, time);
+    ++clock_updates;
+    clock_error_sum += fabs(err);
+}
+
+std::tuple<double, int, double> AudioTrack::clockStats() const{
+    return {clock_updates ? clock_error_sum / clock_updates : 0.0, clock_resets, 1.0 + clock_drift};
 }
 
 void AudioTrack::setPauseStatus(bool p){
     clk.setPaused(p);
 }
 
-void AudioTrack::flush(){
+void AudioTrack::flush(double preroll_target){
     clk.resetTime();
-    AVTrack::flush();
+    last_pos = -1;
+    AVTrack::flush(preroll_target);
 }
 
 static inline
@@ -143,11 +175,30 @@ end:
     return ret;
 }
 
+/* drops the first nb_samples(< frame->nb_samples) samples of the frame */
+static int trim_audio_frame(AVFrame* frame, int nb_samples)
+{
+    if (nb_samples <= 0)
+        return 0;
+
+    const int ret = av_frame_make_writable(frame);
+    if (ret < 0)
+        return ret;
+
+    const int remaining = frame->nb_samples - nb_samples;
+    av_samples_copy(frame->extended_data, frame->extended_data, 0, nb_samples, remaining,
+                    frame->ch_layout.nb_channels, AVSampleFormat(frame->format));
+    frame->nb_samples = remaining;
+    frame->pts += nb_samples;
+    return 0;
+}
+
 void AudioTrack::run()
 {
     AVFrame *frame = av_frame_alloc();
     CAVFrame *af;
     int last_serial = -1;
+    bool graph_stateless = false;
     int got_frame = 0;
     int ret = 0;
 
@@ -158,12 +209,26 @@ void AudioTrack::run()
         if ((got_frame = dec.decode_frame(frame, NULL)) < 0)
             goto the_end;
         else if (got_frame) {
+            /*the decoder outputs timestamps in 1/sample_rate, so the preroll can be trimmed at sample level*/
+            const double preroll_target = dec.preroll_target;
+            if (dec.pkt_serial != pkts.serial() || dec.inPreroll(frame, {1, frame->sample_rate}, 0.0)) {
+                av_frame_unref(frame);
+                continue;
+            }
+            if (!isnan(preroll_target) && frame->pts != AV_NOPTS_VALUE) {
+                const auto nb_samples = std::llrint(preroll_target * frame->sample_rate) - frame->pts;
+                if ((ret = trim_audio_frame(frame, int(std::clamp<int64_t>(nb_samples, 0, frame->nb_samples)))) < 0)
+                    goto the_end;
+            }
+
+            /* the graph is kept across seeks unless it may still hold samples from before them */
+            const bool serial_changed = dec.pkt_serial != last_serial;
             const bool reconfigure =
                 cmp_audio_fmts(audio_filter_src.fmt, audio_filter_src.ch_layout.nb_channels,
                                AVSampleFormat(frame->format), frame->ch_layout.nb_channels)    ||
                 av_channel_layout_compare(&audio_filter_src.ch_layout, &frame->ch_layout) ||
                 audio_filter_src.freq           != frame->sample_rate ||
-                dec.pkt_serial               != last_serial;
+                (serial_changed && !graph_stateless);
 
             if (reconfigure) {
                 char buf1[1024]{}, buf2[1024]{};
@@ -183,6 +248,10 @@ void AudioTrack::run()
 
                 if ((ret = configure_audio_filters(nullptr)) < 0)
                     goto the_end;
+                graph_stateless = filtergraph_is_stateless(agraph);
+            } else if (serial_changed) {
+                av_log(NULL, AV_LOG_DEBUG, "Audio filter graph reused for serial %d\n", dec.pkt_serial);
+                last_serial = dec.pkt_serial;
             }
 
             if ((ret = av_buffersrc_add_frame(in_audio_filter, frame)) < 0)
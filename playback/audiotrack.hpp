@@ -6,6 +6,8 @@
 #include "cavframe.h"
 #include "clock.hpp"
 
+#include <tuple>
+
 class AudioTrack final : public AVTrack
 {
     struct AudioParams {
@@ -16,6 +18,10 @@ class AudioTrack final : public AVTrack
 private:
     FrameQueue<CAVFrame> frame_pool;
     Clock clk;
+    std::atomic<int64_t> last_pos = -1; /*of the last frame taken by the feeder, read by the demuxer*/
+    double clock_drift = 0.0; /*the speed of the clock is 1 + clock_drift*/
+    int clock_updates = 0, clock_resets = 0;
+    double clock_error_sum = 0.0;
 
     AudioParams audio_filter_src;
     AVFilterGraph* agraph = nullptr;
@@ -27,7 +33,7 @@ private:
 
 public:
     AudioTrack() = delete;
-    AudioTrack(const CAVStream& st, std::condition_variable&);
+    AudioTrack(const CAVStream& st, WakeupEvent&);
     ~AudioTrack();
 
     CAVFrame* getFrame();
@@ -35,10 +41,13 @@ public:
     int64_t lastPos();
 
     double getClockVal() const;
-    void updateClock(double pts);
+    /*pts was played at time. The clock is smoothed towards it*/
+    void updateClock(double pts, double time);
+    /*average correction applied to the clock, the number of times it was reset, and its speed*/
+    std::tuple<double, int, double> clockStats() const;
     void setPauseStatus(bool p);
 
-    void flush();
+    void flush(double preroll_target = NAN);
 };
 
 #endif // AUDIOTRACK_HPP
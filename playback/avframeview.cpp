@@ -1,6 +1,6 @@
 #include "avframeview.hpp"
 
-AVFrameView::AVFrameView(const AVFrame& fr) : frame(fr) {}
+AVFrameView::AVFrameView(const AVFrame& fr, DisplayOrientation orientation) : frame(fr), orient(orientation) {}
 
 const uint8_t* const AVFrameView::constDataPlane(int idx) const{
     return frame.extended_data[idx];
@@ -43,6 +43,7 @@ bool AVFrameView::isHW() const{
     return pix_desc && pix_desc->flags & AV_PIX_FMT_FLAG_HWACCEL;
 }
 bool AVFrameView::flipV() const{return linesize(0) < 0;}
+DisplayOrientation AVFrameView::orientation() const{return orient;}
 AVColorSpace AVFrameView::colorSpace() const{return frame.colorspace;}
 AVColorRange AVFrameView::colorRange() const{return frame.color_range;}
 AVColorPrimaries AVFrameView::colorPrim() const{return frame.color_primaries;};
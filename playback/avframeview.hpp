@@ -6,14 +6,24 @@ extern "C"{
 #include "libavutil/pixdesc.h"
 }
 
+/* How the picture is turned for display, applied by the renderer instead of rewriting the pixels.
+ * The flips are applied to the picture as decoded, then the rotation */
+struct DisplayOrientation {
+    int rotation = 0; /*clockwise, in degrees, a multiple of 90*/
+    bool hflip = false, vflip = false;
+
+    bool isTransposed() const {return rotation == 90 || rotation == 270;}
+};
+
 class AVFrameView
 {
 private:
     const AVFrame& frame;
+    const DisplayOrientation orient;
 
 public:
     AVFrameView() = delete;
-    AVFrameView(const AVFrame&);
+    AVFrameView(const AVFrame&, DisplayOrientation orientation = {});
 
     //Common fields
     const uint8_t* const constDataPlane(int idx) const;
@@ -35,6 +45,7 @@ public:
     bool isLimited() const;
     bool isHW() const;
     bool flipV() const;
+    DisplayOrientation orientation() const;
     AVColorSpace colorSpace() const;
     AVColorRange colorRange() const;
     AVColorPrimaries colorPrim() const;
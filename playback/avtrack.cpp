@@ -1,6 +1,6 @@
 #include "avtrack.hpp"
 
-AVTrack::AVTrack(const CAVStream& st, std::condition_variable& empty_q_cond) : dec(st, pkts, empty_q_cond), rel_st(st) {
+AVTrack::AVTrack(const CAVStream& st, WakeupEvent& demux_wakeup, const DecoderConfig& dec_cfg) : dec(st, pkts, dec_cfg), pkts(demux_wakeup), rel_st(st) {
     pkts.start();
 }
 
@@ -9,11 +9,15 @@ AVTrack::~AVTrack(){
     dec.destroy();
 }
 
-void AVTrack::flush(){
+void AVTrack::flush(double preroll_target){
+    /*the flush below starts the next serial*/
+    dec.setPrerollTarget(pkts.serial() + 1, preroll_target);
     pkts.flush();
 }
 
 std::tuple<int, int, double> AVTrack::getQueueParams(){return pkts.getParams();}
+bool AVTrack::queueFull() const{return pkts.isFull();}
+void AVTrack::setLowWaterMark(int nb_pkts, double dur_s, int bytes){pkts.setLowWaterMark(nb_pkts, dur_s, bytes);}
 int AVTrack::serial() {return pkts.serial();}
 
 void AVTrack::putPacket(CAVPacket&& pkt){
@@ -18,13 +18,16 @@ protected:
 
 public:
     AVTrack() = delete;
-    AVTrack(const CAVStream& st, std::condition_variable& empty_q_cond);
+    AVTrack(const CAVStream& st, WakeupEvent& demux_wakeup, const DecoderConfig& dec_cfg = {});
     ~AVTrack();
 
-    void flush();
+    /*preroll_target: the frames ending before it are decoded, but not shown(accurate seeking)*/
+    void flush(double preroll_target = NAN);
     void putPacket(CAVPacket&& pkt);
     void putFinalPacket(int st_idx);
     std::tuple<int, int, double> getQueueParams();
+    bool queueFull() const;
+    void setLowWaterMark(int nb_pkts, double dur_s, int bytes);
     int serial();
 };
 
@@ -0,0 +1,119 @@
+#include "buffercontroller.hpp"
+
+#include <algorithm>
+#include <climits>
+
+BufferController::BufferController(const PlayerOptions& opts) {
+    tracks[TRACK_AUDIO].low = opts.audio_buffer_low;
+    tracks[TRACK_AUDIO].high = std::max(opts.audio_buffer_high, opts.audio_buffer_low);
+    tracks[TRACK_VIDEO].low = opts.video_buffer_low;
+    tracks[TRACK_VIDEO].high = std::max(opts.video_buffer_high, opts.video_buffer_low);
+    min_packets = opts.buffer_min_packets;
+    max_bytes = int64_t(opts.buffer_max_mb) * 1024 * 1024;
+}
+
+void BufferController::setTrack(TrackType type, bool active, int64_t stream_bitrate){
+    auto& tr = tracks[type];
+    tr.active = active;
+    tr.stream_bitrate = stream_bitrate;
+    tr.first_ts = tr.last_ts = NAN;
+    tr.bytes_seen = 0;
+}
+
+void BufferController::reset(){
+    for(auto& tr : tracks){
+        tr.first_ts = tr.last_ts = NAN;
+        tr.bytes_seen = 0;
+    }
+    full = false;
+}
+
+void BufferController::observePacket(TrackType type, const CAVPacket& pkt){
+    auto& tr = tracks[type];
+    const auto ts = pkt.ts();
+    if(std::isnan(ts))
+        return;
+
+    /*Start over on timestamp discontinuities*/
+    if(std::isnan(tr.first_ts) || ts < tr.last_ts - 1.0){
+        tr.first_ts = tr.last_ts = ts;
+        tr.bytes_seen = 0;
+    }
+    tr.last_ts = std::max(tr.last_ts, ts);
+    tr.bytes_seen += pkt.size();
+}
+
+int64_t BufferController::bitrate(TrackType type) const{
+    const auto& tr = tracks[type];
+    if(tr.stream_bitrate > 0)
+        return tr.stream_bitrate;
+
+    const auto span = tr.last_ts - tr.first_ts;
+    if(span >= 1.0)
+        return int64_t(tr.bytes_seen * 8 / span);
+
+    return 0;
+}
+
+/*Returns NAN if the duration can't be determined*/
+double BufferController::buffered(TrackType type, const QueueParams& params) const{
+    const auto [bytes, nb_packets, dur] = params;
+    if(dur > 0.0)
+        return dur;
+    if(nb_packets == 0)
+        return 0.0;
+    const auto br = bitrate(type);
+    if(br > 0)
+        return bytes * 8.0 / br;
+    return NAN;
+}
+
+bool BufferController::isFull(const QueueParams& audio, const QueueParams& video){
+    const QueueParams* params[TRACK_COUNT] = {&audio, &video};
+    int64_t total_bytes = 0;
+    bool all_full = true;
+
+    for(int i = 0; i < TRACK_COUNT; ++i){
+        const auto type = TrackType(i);
+        if(!tracks[type].active)
+            continue;
+        const auto [bytes, nb_packets, dur] = *params[type];
+        const auto buf = buffered(type, *params[type]);
+        total_bytes += bytes;
+        stats.buffered[type] = buf;
+        all_full &= std::isnan(buf) ? nb_packets > min_packets : buf >= tracks[type].high;
+    }
+    stats.bytes = int(std::min<int64_t>(total_bytes, INT_MAX));
+
+    const bool ceiling_hit = total_bytes >= max_bytes;
+    const bool now_full = ceiling_hit || all_full;
+    if(now_full != full){
+        if(now_full){
+            if(ceiling_hit)
+                ++stats.ceiling_hits;
+            av_log(NULL, AV_LOG_VERBOSE, "Buffering: stop reading(%s), audio %.2fs, video %.2fs, %lld KiB queued\n",
+                   ceiling_hit ? "memory ceiling" : "high water mark",
+                   stats.buffered[TRACK_AUDIO], stats.buffered[TRACK_VIDEO], (long long)(total_bytes / 1024));
+        } else{
+            ++stats.refills;
+            av_log(NULL, AV_LOG_VERBOSE, "Buffering: refill, audio %.2fs, video %.2fs, %lld KiB queued\n",
+                   stats.buffered[TRACK_AUDIO], stats.buffered[TRACK_VIDEO], (long long)(total_bytes / 1024));
+        }
+        full = now_full;
+    }
+
+    return full;
+}
+
+BufferController::LowWaterMark BufferController::lowWaterMark(TrackType type) const{
+    const auto& tr = tracks[type];
+    LowWaterMark mark;
+    mark.nb_packets = min_packets / 2;
+    mark.duration = tr.low;
+    mark.bytes = int(std::min<int64_t>(int64_t(tr.low * bitrate(type) / 8), INT_MAX));
+    return mark;
+}
+
+BufferController::Stats BufferController::getStats() const{
+    return stats;
+}
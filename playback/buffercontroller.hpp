@@ -0,0 +1,71 @@
+#ifndef BUFFERCONTROLLER_HPP
+#define BUFFERCONTROLLER_HPP
+
+#include <tuple>
+#include <cmath>
+
+#include <QtGlobal>
+
+#include "cavpacket.hpp"
+#include "playeroptions.hpp"
+
+/* Decides when the demuxer should stop and resume reading. Every track is filled up to
+ * its high water mark(seconds of queued data) and the demuxer is woken up again once any
+ * of them drops below its low water mark. The total size of all queues is capped.
+ * If the packets carry no durations, the buffered duration is estimated from the bitrate. */
+class BufferController final
+{
+    Q_DISABLE_COPY_MOVE(BufferController);
+public:
+    enum TrackType{TRACK_AUDIO, TRACK_VIDEO, TRACK_COUNT};
+
+    /*Size in bytes, number of packets and duration, as returned by PacketQueue::getParams()*/
+    using QueueParams = std::tuple<int, int, double>;
+
+    struct LowWaterMark {
+        int nb_packets = 0;
+        double duration = 0.0;
+        int bytes = 0;
+    };
+
+    struct Stats {
+        int refills = 0, ceiling_hits = 0;
+        int bytes = 0;
+        double buffered[TRACK_COUNT]{};
+    };
+
+private:
+    struct TrackState {
+        bool active = false;
+        double low = 0.0, high = 0.0;
+        int64_t stream_bitrate = 0;
+        /*For the bitrate estimation*/
+        double first_ts = NAN, last_ts = NAN;
+        int64_t bytes_seen = 0;
+    };
+
+    TrackState tracks[TRACK_COUNT];
+    int min_packets = 0;
+    int64_t max_bytes = 0;
+    bool full = false;
+    Stats stats;
+
+    int64_t bitrate(TrackType type) const;
+    double buffered(TrackType type, const QueueParams& params) const;
+
+public:
+    BufferController(const PlayerOptions& opts);
+
+    /*stream_bitrate may be 0 if unknown*/
+    void setTrack(TrackType type, bool active, int64_t stream_bitrate);
+    /*Must be called whenever the queues are flushed*/
+    void reset();
+    void observePacket(TrackType type, const CAVPacket& pkt);
+
+    /*Returns true if the demuxer can stop reading. Inactive tracks are ignored*/
+    bool isFull(const QueueParams& audio, const QueueParams& video);
+    LowWaterMark lowWaterMark(TrackType type) const;
+    Stats getStats() const;
+};
+
+#endif // BUFFERCONTROLLER_HPP
@@ -33,6 +33,7 @@ void CAVFrame::copyParams(const CAVFrame& src){
     duration = src.duration;
     uploaded = false;
     ser = src.serial();
+    orient = src.orient;
 }
 
 bool CAVFrame::create(int w, int h, AVPixelFormat fmt){
@@ -67,7 +68,7 @@ AVRational CAVFrame::sampleAR() const{return frame->sample_aspect_ratio;}
 
 const AVFrame* CAVFrame::constAv() const{return frame;}
 AVFrame* CAVFrame::av() {return frame;}
-void CAVFrame::clear(){av_frame_unref(frame); pkt_pos = -1LL; pts = duration = 0.0; uploaded = false; ser = -1;}
+void CAVFrame::clear(){av_frame_unref(frame); pkt_pos = -1LL; pts = duration = 0.0; uploaded = false; ser = -1; orient = {};}
 bool CAVFrame::ref(const CAVFrame& src){
     const auto res = av_frame_ref(frame, src.constAv());
     return res == 0;
@@ -116,6 +117,8 @@ bool CAVFrame::isHW() const{
     return pix_desc && pix_desc->flags & AV_PIX_FMT_FLAG_HWACCEL;
 }
 bool CAVFrame::flipV() const{return linesize(0) < 0;}
+DisplayOrientation CAVFrame::orientation() const{return orient;}
+void CAVFrame::setOrientation(DisplayOrientation o){orient = o;}
 AVColorSpace CAVFrame::colorSpace() const{return frame->colorspace;}
 AVColorRange CAVFrame::colorRange() const{return frame->color_range;}
 AVColorPrimaries CAVFrame::colorPrim() const{return frame->color_primaries;};
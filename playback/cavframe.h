@@ -6,6 +6,8 @@ extern "C"{
 #include <libavutil/pixdesc.h>
 }
 
+#include "avframeview.hpp"
+
 class CAVFrame
 {
 private:
@@ -14,6 +16,7 @@ private:
     double pts = 0.0, duration = 0.0;
     bool uploaded = false;
     int ser = -1;
+    DisplayOrientation orient;
 
     void copyParams(const CAVFrame& src);
     const AVPixFmtDescriptor* getPixFmtDesc() const;
@@ -59,6 +62,8 @@ public:
     bool isLimited() const;
     bool isHW() const;
     bool flipV() const;
+    DisplayOrientation orientation() const;
+    void setOrientation(DisplayOrientation o);
     AVColorSpace colorSpace() const;
     AVColorRange colorRange() const;
     AVColorPrimaries colorPrim() const;
@@ -1,5 +1,7 @@
 #include "cavpacket.hpp"
 
+#include <cmath>
+
 CAVPacket::CAVPacket() : pkt(av_packet_alloc()){
     if(!pkt) throw;
 }
@@ -58,6 +60,11 @@ int CAVPacket::serial() const{return pkt_serial;}
 
 int CAVPacket::size() const{return pkt->size;}
 
+double CAVPacket::ts() const{
+    const auto ts = (pkt->pts == AV_NOPTS_VALUE) ? pkt->dts : pkt->pts;
+    return (ts == AV_NOPTS_VALUE || !tb.den) ? NAN : av_q2d(tb) * ts;
+}
+
 double CAVPacket::dur() const{return (pkt->duration == AV_NOPTS_VALUE) ? 0.0 : av_q2d(tb) * pkt->duration;}
 
 int CAVPacket::streamIndex() const{return pkt->stream_index;}
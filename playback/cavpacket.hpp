@@ -27,6 +27,7 @@ public:
     bool isFlush() const;
     int size() const;
     double dur() const;
+    double ts() const;
     int serial() const;
     int streamIndex() const;
 
@@ -20,11 +20,17 @@ private:
 
 public:
     double get() const
+    {
+        return getAt(gettime());
+    }
+
+    /*the value at time, on the gettime() clock*/
+    double getAt(double time) const
     {
         if (paused) {
             return pts;
         } else {
-            const double time_drift = gettime() - last_updated;
+            const double time_drift = time - last_updated;
             return pts + time_drift * speed;
         }
     }
@@ -35,6 +41,13 @@ public:
         this->last_updated = gettime();
     }
 
+    /*pts was the value at time, on the gettime() clock*/
+    void setAt(double pts, double time)
+    {
+        this->pts = pts;
+        this->last_updated = time;
+    }
+
     void set_speed(double speed)
     {
         set(get());
@@ -1,13 +1,16 @@
 #include "decoder.hpp"
+#include "threadingpolicy.hpp"
+#include "clock.hpp"
 
-const std::array<AVColorSpace, 3> Decoder::sdl_supported_color_spaces = {
-    AVCOL_SPC_BT709,
-    AVCOL_SPC_BT470BG,
-    AVCOL_SPC_SMPTE170M,
-};
+#include <algorithm>
+#include <iterator>
+#include <cstring>
+
+/* the frames with unknown duration are assumed to last this long when deciding whether they can be skipped */
+#define PREROLL_SKIP_MARGIN 0.1
 
-Decoder::Decoder(const CAVStream& st, PacketQueue &q, std::condition_variable &empty_q_cond) :
-    queue(q), empty_queue_cond(empty_q_cond) {
+Decoder::Decoder(const CAVStream& st, PacketQueue &q, const DecoderConfig& cfg) :
+    queue(q) {
     packet_pending = false;
     finished_serial = 0;
     next_pts = 0LL;
@@ -33,8 +36,14 @@ Decoder::Decoder(const CAVStream& st, PacketQueue &q, std::condition_variable &e
 
     avctx->pkt_timebase = st.tb();
     avctx->codec_id = codec->id;
-    avctx->lowres = 0;
-    avctx->thread_count = (codecpar.codec_type == AVMEDIA_TYPE_VIDEO) ? 0 : 1;
+    avctx->lowres = std::min(cfg.lowres, int(codec->max_lowres));
+    if (cfg.thread_count >= 0)
+        avctx->thread_count = cfg.thread_count;
+    else
+        avctx->thread_count = (codecpar.codec_type == AVMEDIA_TYPE_VIDEO) ? 0 : 1;
+    if (cfg.thread_type)
+        avctx->thread_type = cfg.thread_type;
+    avctx->skip_frame = skip_frame_default = cfg.skip_frame;
     if(!st.isSub())
         avctx->flags |= AV_CODEC_FLAG_COPY_OPAQUE;
 
@@ -44,6 +53,9 @@ Decoder::Decoder(const CAVStream& st, PacketQueue &q, std::condition_variable &e
     if ((ret = avcodec_open2(avctx, codec, nullptr)) < 0) {
         throw std::runtime_error("Failed to open decoder!");
     }
+    /*the automatic thread count is resolved by avcodec_open2*/
+    leased_threads = std::max(avctx->thread_count, 1);
+    ThreadingPolicy::acquire(leased_threads);
 
     if(st.noTimestamps()){
         start_pts = st.startTime();
@@ -55,6 +67,33 @@ Decoder::~Decoder(){
     destroy();
 }
 
+void Decoder::setPrerollTarget(int serial, double target){
+    std::scoped_lock lck(preroll_mutex);
+    next_preroll_serial = serial;
+    next_preroll_target = target;
+}
+
+bool Decoder::inPreroll(const AVFrame* frame, AVRational tb, double fallback_dur){
+    if(isnan(preroll_target) || frame->pts == AV_NOPTS_VALUE)
+        return false;
+
+    const double pts = frame->pts * av_q2d(tb);
+    double dur = fallback_dur;
+    if(avctx->codec_type == AVMEDIA_TYPE_AUDIO && frame->sample_rate > 0)
+        dur = double(frame->nb_samples) / frame->sample_rate;
+    else if(frame->duration > 0)
+        dur = frame->duration * av_q2d(tb);
+    /*the first frame that is still being displayed at the target ends the preroll*/
+    if(pts + dur > preroll_target + 0.001){
+        av_log(NULL, AV_LOG_VERBOSE, "%s preroll to %.3f done, %d frames dropped, %d skipped by the decoder\n",
+               av_get_media_type_string(avctx->codec_type), preroll_target, preroll_discarded, preroll_skipped);
+        preroll_target = NAN;
+        return false;
+    }
+    ++preroll_discarded;
+    return true;
+}
+
 int Decoder::decode_frame(AVFrame *frame, AVSubtitle *sub) {
     int ret = AVERROR(EAGAIN);
 
@@ -98,14 +137,14 @@ int Decoder::decode_frame(AVFrame *frame, AVSubtitle *sub) {
         }
 
         do {
-            const auto [size, nb_packets, dur] = queue.getParams();
-            if (nb_packets == 0)
-                empty_queue_cond.notify_one();
             if (packet_pending) {
                 packet_pending = 0;
             } else {
                 const auto old_serial = pkt_serial;
-                if (queue.get(pkt, true) < 0)
+                const double wait_start = gettime();
+                const int got = queue.get(pkt, true);
+                queue_wait += gettime() - wait_start;
+                if (got < 0)
                     return -1;
                 pkt_serial = pkt.serial();
                 if (old_serial != pkt_serial) {
@@ -113,6 +152,10 @@ int Decoder::decode_frame(AVFrame *frame, AVSubtitle *sub) {
                     finished_serial = 0;
                     next_pts = start_pts;
                     next_pts_tb = start_pts_tb;
+
+                    std::scoped_lock lck(preroll_mutex);
+                    preroll_target = (next_preroll_serial == pkt_serial) ? next_preroll_target : NAN;
+                    preroll_discarded = preroll_skipped = 0;
                 }
             }
 
@@ -145,6 +188,16 @@ int Decoder::decode_frame(AVFrame *frame, AVSubtitle *sub) {
                 fd->pkt_pos = pkt.constAv()->pos;
             }
 
+            if (avctx->codec_type == AVMEDIA_TYPE_VIDEO && !packet_pending) {
+                /*the non-reference frames ending before the preroll target are never shown and nothing
+                 * depends on them, so the decoder doesn't need to decode them at all*/
+                const auto ts = pkt.ts(), dur = pkt.dur();
+                const bool skip = !isnan(preroll_target) && !isnan(ts)
+                                  && ts + (dur > 0.0 ? dur : PREROLL_SKIP_MARGIN) <= preroll_target;
+                avctx->skip_frame = skip ? std::max(AVDISCARD_NONREF, skip_frame_default) : skip_frame_default;
+                preroll_skipped += skip;
+            }
+
             if (avcodec_send_packet(avctx, pkt.constAv()) == AVERROR(EAGAIN)) {
                 av_log(avctx, AV_LOG_ERROR, "Receive_frame and send_packet both returned EAGAIN, which is an API violation.\n");
                 packet_pending = 1;
@@ -156,9 +209,34 @@ int Decoder::decode_frame(AVFrame *frame, AVSubtitle *sub) {
 }
 
 void Decoder::destroy() {
+    ThreadingPolicy::release(leased_threads);
+    leased_threads = 0;
     avcodec_free_context(&avctx);
 }
 
+/* The filters that never hold frames or samples back, nor depend on the previous ones */
+static const char* const stateless_filters[] = {
+    "buffer", "buffersink", "abuffer", "abuffersink", "null", "anull", "format", "aformat",
+    "scale", "transpose", "hflip", "vflip", "rotate", "crop", "setsar", "setdar",
+};
+
+bool filtergraph_is_stateless(const AVFilterGraph *graph)
+{
+    for (unsigned i = 0; i < graph->nb_filters; i++) {
+        const AVFilterContext *f = graph->filters[i];
+        /*only a sample rate conversion keeps samples back*/
+        if (!strcmp(f->filter->name, "aresample")) {
+            if (f->nb_inputs && f->nb_outputs && f->inputs[0]->sample_rate != f->outputs[0]->sample_rate)
+                return false;
+            continue;
+        }
+        if (std::none_of(std::begin(stateless_filters), std::end(stateless_filters),
+                         [f](const char* name){return !strcmp(f->filter->name, name);}))
+            return false;
+    }
+    return true;
+}
+
 int configure_filtergraph(AVFilterGraph *graph, const char *filtergraph,
                                  AVFilterContext *source_ctx, AVFilterContext *sink_ctx)
 {
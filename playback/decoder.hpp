@@ -5,6 +5,8 @@
 #include "cavstream.hpp"
 
 #include <thread>
+#include <mutex>
+#include <cmath>
 
 extern "C"{
 #include <libavcodec/avcodec.h>
@@ -15,10 +17,16 @@ struct FrameData {
     int64_t pkt_pos = -1LL;
 };
 
+struct DecoderConfig {
+    int lowres = 0; /*clamped to what the codec supports*/
+    int thread_count = -1; /*-1: automatic for video, single threaded otherwise*/
+    int thread_type = 0; /*FF_THREAD_FRAME or FF_THREAD_SLICE, 0 for the codec default*/
+    AVDiscard skip_frame = AVDISCARD_DEFAULT;
+};
+
 struct Decoder
 {
     Q_DISABLE_COPY_MOVE(Decoder);
-    static const std::array<AVColorSpace, 3> sdl_supported_color_spaces;
 
     enum class DecRes{ERROR = -2, ABORT, TRY_AGAIN, SUCCESS};
 
@@ -27,15 +35,28 @@ struct Decoder
     AVCodecContext *avctx = nullptr;
     int pkt_serial = 0, finished_serial = 0;
     bool packet_pending = false;
-    std::condition_variable& empty_queue_cond;
     int64_t start_pts = 0;
     AVRational start_pts_tb{};
     int64_t next_pts = 0;
     AVRational next_pts_tb{};
     std::thread decoder_thr;
 
-    Decoder(const CAVStream& st, PacketQueue &queue, std::condition_variable &empty_queue_cond);
+    /*Accurate seeking: the frames ending before the target are decoded, but dropped by the track.
+     * The target is set by the demuxer for a serial and picked up by the decoder when it reaches that serial*/
+    std::mutex preroll_mutex;
+    int next_preroll_serial = -1;
+    double next_preroll_target = NAN;
+    double preroll_target = NAN; /*for pkt_serial, NAN once the preroll is over*/
+    int preroll_discarded = 0, preroll_skipped = 0;
+    AVDiscard skip_frame_default = AVDISCARD_DEFAULT;
+    int leased_threads = 0; /*accounted in ThreadingPolicy*/
+    double queue_wait = 0.0; /*total time spent waiting for packets, in seconds*/
+
+    Decoder(const CAVStream& st, PacketQueue &queue, const DecoderConfig& cfg = {});
     int decode_frame(AVFrame *frame, AVSubtitle *sub);
+    void setPrerollTarget(int serial, double target);
+    /*Returns true if the frame(pts in tb) ends before the preroll target and must not be shown*/
+    bool inPreroll(const AVFrame* frame, AVRational tb, double fallback_dur);
 
     void destroy();
 
@@ -56,5 +77,8 @@ public:
 
 int configure_filtergraph(AVFilterGraph *graph, const char *filtergraph,
                           AVFilterContext *source_ctx, AVFilterContext *sink_ctx);
+/*True if the configured graph can be kept across a flush(seek): none of its filters carry frames
+ * from before it. Otherwise it has to be rebuilt for every serial*/
+bool filtergraph_is_stateless(const AVFilterGraph *graph);
 
 #endif // DECODER_HPP
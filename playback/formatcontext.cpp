@@ -77,15 +77,18 @@ int64_t FormatContext::size() const {
     return res;
 }
 
-bool FormatContext::seek(const SeekInfo& info, double last_pts, int64_t last_pos){
-    auto set_seek = [&](int64_t pos, int64_t rel)
+bool FormatContext::prepareSeek(const SeekInfo& info, double last_pts, int64_t last_pos){
+    /*time_s is the target in seconds, even when seeking by bytes(NAN if unknown)*/
+    auto set_seek = [&](int64_t pos, int64_t rel, double time_s)
     {
         last_seek_pos = pos;
         last_seek_rel = rel;
+        last_seek_time = time_s;
     };
 
     auto seek_incr = [&](double incr){
         if (seek_by_bytes) {
+            const double time_s = last_pts + incr;
             int64_t pos = last_pos;
             if (pos < 0)
                 pos = bytePos();
@@ -94,7 +97,7 @@ bool FormatContext::seek(const SeekInfo& info, double last_pts, int64_t last_pos
             else
                 incr *= 180000.0;
             pos += incr;
-            set_seek(pos, incr);
+            set_seek(pos, incr, time_s);
         } else {
             auto pos = last_pts;
             if (isnan(pos))
@@ -102,11 +105,12 @@ bool FormatContext::seek(const SeekInfo& info, double last_pts, int64_t last_pos
             pos += incr;
             if (startTime() != AV_NOPTS_VALUE && pos < startTime() / (double)AV_TIME_BASE)
                 pos = startTime() / (double)AV_TIME_BASE;
-            set_seek((int64_t)(pos * AV_TIME_BASE), (int64_t)(incr * AV_TIME_BASE));
+            set_seek((int64_t)(pos * AV_TIME_BASE), (int64_t)(incr * AV_TIME_BASE), pos);
         }
     };
 
     bool seek_in_stream = false;
+    last_seek_time = NAN;
     const bool unseekable = (ic->flags & AVFMTCTX_UNSEEKABLE);
     if(unseekable && info.type != SeekInfo::SEEK_STREAM_SWITCH)
         return false;
@@ -116,7 +120,7 @@ bool FormatContext::seek(const SeekInfo& info, double last_pts, int64_t last_pos
         const auto pcent = info.percent;
         if (seek_by_bytes || ic->duration <= 0) {
             const uint64_t size =  avio_size(ic->pb);
-            set_seek(size*pcent, 0);
+            set_seek(size*pcent, 0, isnan(duration_s) ? NAN : pcent * duration_s + startTimeS());
         } else {
             int64_t ts;
             int ns, hh, mm, ss;
@@ -135,7 +139,7 @@ bool FormatContext::seek(const SeekInfo& info, double last_pts, int64_t last_pos
             ts = pcent * ic->duration;
             if (ic->start_time != AV_NOPTS_VALUE)
                 ts += ic->start_time;
-            set_seek(ts, 0);
+            set_seek(ts, 0, double(ts) / AV_TIME_BASE);
         }
         seek_in_stream = !unseekable;
     }
@@ -165,8 +169,8 @@ bool FormatContext::seek(const SeekInfo& info, double last_pts, int64_t last_pos
             i = std::max(i + ch_incr, 0);
             if (i < ic->nb_chapters){
                 av_log(NULL, AV_LOG_VERBOSE, "Seeking to chapter %d.\n", i);
-                set_seek(av_rescale_q(ic->chapters[i]->start, ic->chapters[i]->time_base,
-                                      AV_TIME_BASE_Q), 0);
+                const auto ts = av_rescale_q(ic->chapters[i]->start, ic->chapters[i]->time_base, AV_TIME_BASE_Q);
+                set_seek(ts, 0, double(ts) / AV_TIME_BASE);
             }
         } else{
             seek_incr(ch_incr * 600.0);
@@ -180,21 +184,60 @@ bool FormatContext::seek(const SeekInfo& info, double last_pts, int64_t last_pos
         break;
     }
 
-    bool seek_succeeded = !seek_in_stream;
-    if(seek_in_stream){
-        /*Execute the seek*/
-        // FIXME the +-2 is due to rounding being not done in the correct direction in generation
-        //      of the seek_pos/seek_rel variables
-        const int64_t seek_target = last_seek_pos;
-        const int64_t seek_min    = last_seek_rel > 0 ? seek_target - last_seek_rel + 2: INT64_MIN;
-        const int64_t seek_max    = last_seek_rel < 0 ? seek_target - last_seek_rel - 2: INT64_MAX;
+    return seek_in_stream;
+}
+
+double FormatContext::seekTargetTime() const{
+    return last_seek_time;
+}
 
-        const auto seek_flags = seek_by_bytes ? AVSEEK_FLAG_BYTE : 0;
-        const auto seekRes = avformat_seek_file(ic, -1, seek_min, seek_target, seek_max, seek_flags);
-        seek_succeeded = seekRes >= 0;
-        if(seek_succeeded)
-            eof = false;
+bool FormatContext::seekToKeyframe(int st_idx, int64_t ts, int64_t pos){
+    int ret = -1;
+    /*Only the demuxers that read the packets sequentially from the current position can be
+     * repositioned by bytes, the others(mov...) keep their own read state*/
+    const bool byte_seekable = !(ic->iformat->flags & AVFMT_NO_BYTE_SEEK)
+                               && (seek_by_bytes || (ic->iformat->flags & AVFMT_GENERIC_INDEX));
+    if(pos >= 0 && byte_seekable){
+        ret = avformat_seek_file(ic, -1, pos, pos, pos, AVSEEK_FLAG_BYTE);
     }
+    if(ret < 0 && st_idx >= 0 && st_idx < streamCount()){
+        ret = avformat_seek_file(ic, st_idx, INT64_MIN, ts, ts, 0);
+    }
+    if(ret >= 0)
+        eof = false;
+
+    return ret >= 0;
+}
+
+bool FormatContext::seekTo(double time_s){
+    const auto ts = int64_t(time_s * AV_TIME_BASE);
+    const bool seek_succeeded = avformat_seek_file(ic, -1, INT64_MIN, ts, ts, 0) >= 0;
+    if(seek_succeeded)
+        eof = false;
+
+    return seek_succeeded;
+}
+
+bool FormatContext::hasIndex(int st_idx) const{
+    if(st_idx < 0 || st_idx >= streamCount())
+        return false;
+    return avformat_index_get_entries_count(ic->streams[st_idx]) > 0;
+}
+
+bool FormatContext::executeSeek(bool before_target){
+    // FIXME the +-2 is due to rounding being not done in the correct direction in generation
+    //      of the seek_pos/seek_rel variables
+    const int64_t seek_target = last_seek_pos;
+    const int64_t seek_min    = last_seek_rel > 0 ? seek_target - last_seek_rel + 2: INT64_MIN;
+    int64_t seek_max          = last_seek_rel < 0 ? seek_target - last_seek_rel - 2: INT64_MAX;
+    if (before_target && !seek_by_bytes)
+        seek_max = seek_target;
+
+    const auto seek_flags = seek_by_bytes ? AVSEEK_FLAG_BYTE : 0;
+    const auto seekRes = avformat_seek_file(ic, -1, seek_min, seek_target, seek_max, seek_flags);
+    const bool seek_succeeded = seekRes >= 0;
+    if(seek_succeeded)
+        eof = false;
 
     return seek_succeeded;
 }
@@ -286,6 +329,7 @@ int64_t FormatContext::bytePos() const{
 }
 int64_t FormatContext::bitrate() const{return ic->bit_rate;}
 int64_t FormatContext::startTime() const{return ic->start_time;}
+double FormatContext::startTimeS() const{return ic->start_time == AV_NOPTS_VALUE ? 0.0 : double(ic->start_time) / AV_TIME_BASE;}
 CAVPacket FormatContext::attachedPic() const{
     CAVPacket pkt;
     if(video_idx >= 0 && streamAt(video_idx).isAttachedPic()){
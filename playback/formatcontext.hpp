@@ -19,6 +19,8 @@ struct SeekInfo final {
     SeekType type = SEEK_NONE;
     double percent = 0.0, increment = 0.0;
     int chapter_incr = 0, chapter_nb = -1;
+    /*scrub: only the nearest video keyframe is shown(slider dragging), accurate: decode up to the exact target*/
+    bool scrub = false, accurate = false;
 
     /*if stream_idx is negative and stream_type is set, then the streams of given type are cycled*/
     int stream_idx = -1;
@@ -35,6 +37,7 @@ private:
     double max_frame_duration = 0.0, duration_s = 0.0;
     int video_idx = -1, video_last_idx = -1, audio_idx = -1, audio_last_idx = -1, sub_idx = -1, sub_last_idx = -1;
     int64_t last_seek_pos = 0, last_seek_rel = 0;
+    double last_seek_time = NAN;
     std::string stream_title;
 
 public:
@@ -48,7 +51,18 @@ public:
     double maxFrameDuration() const;
     double duration() const;
     int64_t size() const;
-    bool seek(const SeekInfo& info, double last_pts, int64_t last_pos);
+    /*Computes the seek target. Returns true if a seek in the stream is required*/
+    bool prepareSeek(const SeekInfo& info, double last_pts, int64_t last_pos);
+    /*Target of the last prepared seek in seconds, NAN if unknown*/
+    double seekTargetTime() const;
+    /*before_target: land on the keyframe at or before the target, so it can be decoded up to it*/
+    bool executeSeek(bool before_target = false);
+    /*Seeks exactly to a known keyframe, by its byte position if the format allows it*/
+    bool seekToKeyframe(int st_idx, int64_t ts, int64_t pos);
+    /*Seeks to the keyframe at or before time_s(in seconds)*/
+    bool seekTo(double time_s);
+    /*Returns true if the demuxer has an index of the stream to seek with*/
+    bool hasIndex(int st_idx) const;
     bool setStreamEnabled(int idx, bool enabled);
     int read(CAVPacket& into);//Returns the error codes from av_read_frame()
     std::vector<CAVStream> streams() const;
@@ -62,6 +76,7 @@ public:
     int64_t bytePos() const;
     int64_t bitrate() const;
     int64_t startTime() const;
+    double startTimeS() const;
     CAVPacket attachedPic() const;
     std::string title() const;
 };
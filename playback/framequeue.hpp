@@ -8,6 +8,9 @@
 #define SAMPLE_QUEUE_SIZE 9
 #define FRAME_QUEUE_SIZE std::max(SAMPLE_QUEUE_SIZE, std::max(VIDEO_PICTURE_QUEUE_SIZE, SUBPICTURE_QUEUE_SIZE))
 
+/* Single-producer/single-consumer frame ring. The decoder thread is the producer(peek_writable, push)
+ * and the refresh loop is the consumer(peek*, next, nb_remaining). The fill level is the only shared
+ * state, so it is kept atomic and the mutex is taken only when one of the sides has to sleep. */
 template <typename T>
 class FrameQueue final {
     Q_DISABLE_COPY_MOVE(FrameQueue);
@@ -15,14 +18,32 @@ class FrameQueue final {
     T queue[FRAME_QUEUE_SIZE];
     int rindex = 0;
     int windex = 0;
-    int size = 0;
+    std::atomic<int> size = 0;
     int max_size = 0;
     int keep_last = 0;
     int rindex_shown = 0;
+    std::atomic_bool producer_waiting = false, consumer_waiting = false;
     std::mutex mutex;
     std::condition_variable cond;
     PacketQueue& pktq;
 
+    void wake(const std::atomic_bool& waiting)
+    {
+        if (waiting.load()) {
+            std::scoped_lock lck(mutex);
+            cond.notify_all();
+        }
+    }
+
+    template <typename Pred>
+    void wait_until(std::atomic_bool& waiting, Pred pred)
+    {
+        std::unique_lock lck(mutex);
+        waiting = true;
+        cond.wait(lck, [&]{return pred() || pktq.isAborted();});
+        waiting = false;
+    }
+
 public:
     FrameQueue(PacketQueue &q, int max_size, int keep_last) : pktq(q)
     {
@@ -39,7 +60,7 @@ public:
     void notify()
     {
         std::scoped_lock lck(mutex);
-        cond.notify_one();
+        cond.notify_all();
     }
 
     T *peek()
@@ -60,11 +81,8 @@ public:
     T *peek_writable()
     {
         /* wait until we have space to put a new frame */
-        std::unique_lock lck(mutex);
-        while (size >= max_size &&
-               !pktq.isAborted()) {
-            cond.wait(lck);
-        }
+        if (size.load() >= max_size && !pktq.isAborted())
+            wait_until(producer_waiting, [this]{return size.load() < max_size;});
 
         if (pktq.isAborted())
             return NULL;
@@ -75,11 +93,8 @@ public:
     T *peek_readable()
     {
         /* wait until we have a readable a new frame */
-        std::unique_lock lck(mutex);
-        while (size - rindex_shown <= 0 &&
-               !pktq.isAborted()) {
-            cond.wait(lck);
-        }
+        if (size.load() - rindex_shown <= 0 && !pktq.isAborted())
+            wait_until(consumer_waiting, [this]{return size.load() - rindex_shown > 0;});
 
         if (pktq.isAborted())
             return NULL;
@@ -91,9 +106,8 @@ public:
     {
         if (++windex == max_size)
             windex = 0;
-        std::scoped_lock lck(mutex);
-        size++;
-        cond.notify_one();
+        size.fetch_add(1);
+        wake(consumer_waiting);
     }
 
     void next()
@@ -105,16 +119,14 @@ public:
         queue[rindex].clear();
         if (++rindex == max_size)
             rindex = 0;
-        std::scoped_lock lck(mutex);
-        size--;
-        cond.notify_one();
+        size.fetch_sub(1);
+        wake(producer_waiting);
     }
 
     /* return the number of undisplayed frames in the queue */
     int nb_remaining()
     {
-        std::scoped_lock lck(mutex);
-        return size - rindex_shown;
+        return size.load() - rindex_shown;
     }
 
     int rindexShown() const{
@@ -124,7 +136,6 @@ public:
     /* return last shown position */
     int64_t last_pos()
     {
-        std::scoped_lock lck(mutex);
         const T& fp = queue[rindex];
         if (rindexShown() && fp.serial() == pktq.serial())
             return fp.pktPos();
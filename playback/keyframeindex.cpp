@@ -0,0 +1,124 @@
+#include "keyframeindex.hpp"
+#include "formatcontext.hpp"
+
+#include <algorithm>
+#include <iterator>
+
+#define KEYFRAME_INDEX_MIN_GAP 0.5 /*in seconds, for the sparse indexes*/
+/* a timestamp going back by more than this is a discontinuity, the index is only valid up to it */
+#define KEYFRAME_INDEX_MAX_JUMP_BACK 1.0
+
+static int index_interrupt_cb(void* opaque){
+    return static_cast<std::atomic_bool*>(opaque)->load();
+}
+
+KeyframeIndex::KeyframeIndex(std::string u, int idx, bool sp) : url(std::move(u)), st_idx(idx), sparse(sp) {
+    scan_thr = std::thread(&KeyframeIndex::run, this);
+}
+
+KeyframeIndex::~KeyframeIndex(){
+    abort_req = true;
+    if(scan_thr.joinable())
+        scan_thr.join();
+}
+
+void KeyframeIndex::append(const Entry& e, double ts_reached){
+    std::scoped_lock lck(mutex);
+    if(entries.empty() || (e.ts > entries.back().ts && (!sparse || e.ts - entries.back().ts >= KEYFRAME_INDEX_MIN_GAP)))
+        entries.push_back(e);
+    if(std::isnan(scanned_until) || ts_reached > scanned_until)
+        scanned_until = ts_reached;
+}
+
+void KeyframeIndex::finish(const char* reason){
+    std::scoped_lock lck(mutex);
+    finished = true;
+    av_log(NULL, AV_LOG_VERBOSE, "Keyframe index of stream %d: %zu entries up to %.3f, scan stopped(%s)\n",
+           st_idx, entries.size(), scanned_until, reason);
+}
+
+void KeyframeIndex::run(){
+    std::optional<FormatContext> fmt;
+    try{
+        fmt.emplace(url, index_interrupt_cb, &abort_req);
+    } catch(std::exception& ex){
+        finish(ex.what());
+        return;
+    }
+    /*All the other streams stay discarded, so the demuxer only returns the packets we need*/
+    if(!fmt->setStreamEnabled(st_idx, true)){
+        finish("invalid stream");
+        return;
+    }
+
+    CAVPacket pkt;
+    double last_ts = NAN;
+    int subsequent_err_count = 0;
+    while(!abort_req.load()){
+        pkt.unref();
+        const int ret = fmt->read(pkt);
+        if(ret == AVERROR_EOF){
+            {
+                /*everything was scanned, the last entry is valid up to the end*/
+                std::scoped_lock lck(mutex);
+                scanned_until = INFINITY;
+            }
+            finish("end of file");
+            return;
+        }
+        if(ret < 0){
+            if(ret == AVERROR_EXIT || ++subsequent_err_count > 1000){
+                finish("read error");
+                return;
+            }
+            continue;
+        }
+        subsequent_err_count = 0;
+
+        const auto av = pkt.constAv();
+        const auto ts = pkt.ts();
+        if(av->stream_index != st_idx || std::isnan(ts))
+            continue;
+        if(!std::isnan(last_ts) && ts < last_ts - KEYFRAME_INDEX_MAX_JUMP_BACK){
+            finish("timestamp discontinuity");
+            return;
+        }
+        last_ts = std::isnan(last_ts) ? ts : std::max(last_ts, ts);
+
+        if(av->flags & AV_PKT_FLAG_KEY){
+            append(Entry{ts, av->pts != AV_NOPTS_VALUE ? av->pts : av->dts, av->pos}, last_ts);
+        } else{
+            std::scoped_lock lck(mutex);
+            scanned_until = last_ts;
+        }
+    }
+    finish("aborted");
+}
+
+std::optional<KeyframeIndex::Entry> KeyframeIndex::lookup(double target) const{
+    std::scoped_lock lck(mutex);
+    if(entries.empty() || std::isnan(target) || std::isnan(scanned_until) || target > scanned_until)
+        return std::nullopt;
+
+    /*the first entry with ts > target, the one before it is what we seek to. A target before the
+     * first keyframe is left to the demuxer, it would land past the target otherwise*/
+    auto it = std::upper_bound(entries.begin(), entries.end(), target,
+                               [](double t, const Entry& e){return t < e.ts;});
+    if(it == entries.begin())
+        return std::nullopt;
+    return *std::prev(it);
+}
+
+int KeyframeIndex::size() const{
+    std::scoped_lock lck(mutex);
+    return static_cast<int>(entries.size());
+}
+
+int KeyframeIndex::streamIndex() const{
+    return st_idx;
+}
+
+bool KeyframeIndex::isFinished() const{
+    std::scoped_lock lck(mutex);
+    return finished;
+}
@@ -0,0 +1,56 @@
+#ifndef KEYFRAMEINDEX_HPP
+#define KEYFRAMEINDEX_HPP
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <optional>
+#include <cmath>
+
+#include <QtGlobal>
+
+/* Builds an index of the keyframes of one stream in the background. The file is opened a second
+ * time and the packets of that stream are read without being decoded, recording the timestamp
+ * and byte position of every keyframe. The index can be used while it is being built: lookups
+ * succeed as soon as the scan has passed the requested position. */
+class KeyframeIndex final
+{
+    Q_DISABLE_COPY_MOVE(KeyframeIndex);
+public:
+    struct Entry {
+        double ts = 0.0; /*in seconds*/
+        int64_t pts = 0; /*in the stream time base*/
+        int64_t pos = -1; /*byte position in the file, -1 if unknown*/
+    };
+
+private:
+    const std::string url;
+    const int st_idx;
+    const bool sparse; /*keep at most one entry per KEYFRAME_INDEX_MIN_GAP(audio, where every packet is a keyframe)*/
+
+    mutable std::mutex mutex;
+    std::vector<Entry> entries;
+    double scanned_until = NAN;
+    bool finished = false;
+
+    std::atomic_bool abort_req = false;
+    std::thread scan_thr;
+
+    void run();
+    void append(const Entry& e, double ts_reached);
+    void finish(const char* reason);
+
+public:
+    KeyframeIndex(std::string url, int st_idx, bool sparse);
+    ~KeyframeIndex();
+
+    /*Returns the last keyframe at or before target(in seconds), if the scan got past target and there is one*/
+    std::optional<Entry> lookup(double target) const;
+    int size() const;
+    int streamIndex() const;
+    bool isFinished() const;
+};
+
+#endif // KEYFRAMEINDEX_HPP
@@ -0,0 +1,91 @@
+#include "packetcache.hpp"
+
+#include <cmath>
+
+PacketCache::PacketCache(int64_t max_b) : max_bytes(max_b) {}
+
+bool PacketCache::isAnchorKey(const CAVPacket& pkt) const{
+    return pkt.streamIndex() == anchor_idx && (pkt.constAv()->flags & AV_PKT_FLAG_KEY);
+}
+
+void PacketCache::setAnchorStream(int st_idx){
+    clear();
+    anchor_idx = st_idx;
+}
+
+void PacketCache::clear(){
+    pkts.clear();
+    byte_size = 0;
+    replay_pos = 0;
+    replaying = false;
+}
+
+void PacketCache::add(const CAVPacket& pkt){
+    if(max_bytes <= 0 || anchor_idx < 0 || pkt.isEmpty())
+        return;
+    /*The window must start at a keyframe*/
+    if(pkts.empty() && !isAnchorKey(pkt))
+        return;
+    pkts.push_back(pkt);
+    byte_size += pkt.size();
+
+    if(byte_size > max_bytes){
+        /*Drop whole GOPs from the front: evict up to the first keyframe that leaves us within the limit*/
+        do{
+            byte_size -= pkts.front().size();
+            pkts.pop_front();
+        } while(!pkts.empty() && (byte_size > max_bytes || !isAnchorKey(pkts.front())));
+    }
+}
+
+bool PacketCache::startReplay(double target){
+    replaying = false;
+    if(std::isnan(target) || pkts.empty())
+        return false;
+
+    /*The target must not be past the end of the window*/
+    double last_ts = NAN;
+    for(auto it = pkts.rbegin(); it != pkts.rend() && std::isnan(last_ts); ++it){
+        if(it->streamIndex() == anchor_idx)
+            last_ts = it->ts();
+    }
+    if(std::isnan(last_ts) || target > last_ts)
+        return false;
+
+    /*Find the last anchor keyframe at or before the target*/
+    for(size_t i = pkts.size(); i-- > 0;){
+        const auto& pkt = pkts[i];
+        if(!isAnchorKey(pkt))
+            continue;
+        const auto ts = pkt.ts();
+        if(std::isnan(ts) || ts > target)
+            continue;
+
+        replay_pos = i;
+        replaying = true;
+        ++hits;
+        av_log(NULL, AV_LOG_VERBOSE, "Seek to %.3f served from the packet cache, replaying from %.3f(%zu packets)\n",
+               target, ts, pkts.size() - i);
+        return true;
+    }
+
+    return false;
+}
+
+bool PacketCache::isReplaying() const{
+    return replaying;
+}
+
+bool PacketCache::replayNext(CAVPacket& dst){
+    if(!replaying || replay_pos >= pkts.size()){
+        replaying = false;
+        return false;
+    }
+
+    dst = pkts[replay_pos++];
+    return true;
+}
+
+int PacketCache::hitCount() const{
+    return hits;
+}
@@ -0,0 +1,45 @@
+#ifndef PACKETCACHE_HPP
+#define PACKETCACHE_HPP
+
+#include <deque>
+
+#include <QtGlobal>
+
+#include "cavpacket.hpp"
+
+/* Keeps references to the most recently demuxed packets, in demuxing order, so that a seek
+ * inside the cached window can be served by replaying them instead of seeking the container.
+ * The window is bounded by size and always starts at a keyframe of the anchor stream(video, or
+ * audio if there is no video). The cached packets are contiguous up to the current read position
+ * of the container, so once the replay is over, demuxing simply continues from the container. */
+class PacketCache final
+{
+    Q_DISABLE_COPY_MOVE(PacketCache);
+private:
+    std::deque<CAVPacket> pkts;
+    int64_t byte_size = 0, max_bytes = 0;
+    int anchor_idx = -1;
+    size_t replay_pos = 0;
+    bool replaying = false;
+    int hits = 0;
+
+    bool isAnchorKey(const CAVPacket& pkt) const;
+
+public:
+    PacketCache(int64_t max_bytes);
+
+    /*Sets the stream whose keyframes the window is aligned to. Clears the cache*/
+    void setAnchorStream(int st_idx);
+    void clear();
+    void add(const CAVPacket& pkt);
+
+    /*Starts replaying from the last anchor keyframe at or before target(in seconds).
+     * Returns false if target is outside the cached window.*/
+    bool startReplay(double target);
+    bool isReplaying() const;
+    /*Returns false once all the cached packets were replayed*/
+    bool replayNext(CAVPacket& dst);
+    int hitCount() const;
+};
+
+#endif // PACKETCACHE_HPP
@@ -1,30 +1,95 @@
 #include "packetqueue.hpp"
 
-PacketQueue::PacketQueue() {}
+#include <cmath>
+#include <algorithm>
+
+static int64_t dur_to_us(double dur){
+    return std::llrint(dur * 1000000.0);
+}
+
+PacketQueue::PacketQueue(WakeupEvent& wakeup, int capacity) : pkt_buf(capacity), capacity_mask(capacity - 1), producer_wakeup(wakeup) {
+    Q_ASSERT(capacity > 1 && (capacity & (capacity - 1)) == 0);
+}
+
+/*Producer side. Stores the packet into the slot at pos, but does not publish it*/
+bool PacketQueue::push_one(CAVPacket&& pkt, uint64_t pos)
+{
+    if (pos - head.load(std::memory_order_acquire) > capacity_mask)
+        return false;
+
+    pkt.setSerial(serial_val.load(std::memory_order_relaxed));
+    bytes_in.fetch_add(pkt.size(), std::memory_order_relaxed);
+    dur_in_us.fetch_add(dur_to_us(pkt.dur()), std::memory_order_relaxed);
+    pkts_in.fetch_add(1, std::memory_order_relaxed);
+    pkt_buf[pos & capacity_mask] = std::move(pkt);
+
+    return true;
+}
+
+void PacketQueue::wake_consumer()
+{
+    if (consumer_waiting.load()) {
+        std::scoped_lock lck(mutex);
+        cond.notify_one();
+    }
+}
+
+void PacketQueue::maybe_wake_producer()
+{
+    const auto [size, nb_packets, dur] = getParams();
+    const auto low_bytes = low_water_bytes.load(std::memory_order_relaxed);
+    bool low = false;
+    if (dur > 0.0)
+        low = dur < low_water_dur.load(std::memory_order_relaxed);
+    else if (low_bytes > 0)
+        low = size < low_bytes;
+    else
+        low = nb_packets < low_water_pkts.load(std::memory_order_relaxed);
+
+    if (low)
+        producer_wakeup.signal();
+}
+
+void PacketQueue::setLowWaterMark(int nb_pkts, double dur_s, int bytes)
+{
+    low_water_pkts.store(nb_pkts, std::memory_order_relaxed);
+    low_water_dur.store(dur_s, std::memory_order_relaxed);
+    low_water_bytes.store(bytes, std::memory_order_relaxed);
+}
 
 bool PacketQueue::put(CAVPacket&& pkt)
 {
-    std::unique_lock lck(mutex);
-    if(int_abort_req)
+    if (abort_req.load(std::memory_order_relaxed))
         return false;
 
-    pkt.setSerial(int_serial);
-    const double dur = pkt.dur();
-    const auto size = pkt.size();
-    try{
-        pkt_buf.push(std::move(pkt));
-    } catch(...){
+    const auto pos = tail.load(std::memory_order_relaxed);
+    if (!push_one(std::move(pkt), pos))
         return false;
-    }
 
-    duration_s += dur;
-    byte_size += size;
-    ++nb_packets;
-    cond.notify_one();
+    tail.store(pos + 1);
+    wake_consumer();
 
     return true;
 }
 
+int PacketQueue::put(CAVPacket* pkts, int count)
+{
+    if (abort_req.load(std::memory_order_relaxed))
+        return 0;
+
+    const auto first = tail.load(std::memory_order_relaxed);
+    auto pos = first;
+    for (int i = 0; i < count && push_one(std::move(pkts[i]), pos); ++i)
+        ++pos;
+
+    if (pos != first) {
+        tail.store(pos);
+        wake_consumer();
+    }
+
+    return static_cast<int>(pos - first);
+}
+
 bool PacketQueue::put_nullpacket(int stream_index)
 {
     CAVPacket pkt;
@@ -32,82 +97,125 @@ bool PacketQueue::put_nullpacket(int stream_index)
     return put(std::move(pkt));
 }
 
+/*The packets that are already in the queue can't be touched by the producer, so they are
+ * left for the consumer to drop all at once on its next get(). They still count in the
+ * statistics until then, the memory they hold isn't released before.*/
 void PacketQueue::flush()
 {
-    std::scoped_lock lck(mutex);
-    pkt_buf = {};
-    nb_packets = 0;
-    byte_size = 0;
-    duration_s = 0.0;
-    ++ext_serial;
-    ++int_serial;
+    discard_pos.store(tail.load(std::memory_order_relaxed), std::memory_order_release);
+    ++serial_val;
+}
+
+/*Consumer side. Accounts for the packet leaving the queue*/
+void PacketQueue::take_one(CAVPacket& pkt)
+{
+    bytes_out.fetch_add(pkt.size(), std::memory_order_relaxed);
+    dur_out_us.fetch_add(dur_to_us(pkt.dur()), std::memory_order_relaxed);
+    pkts_out.fetch_add(1, std::memory_order_relaxed);
+}
+
+/*Consumer side. Releases the flushed packets from pos on, returns the position after them*/
+uint64_t PacketQueue::drop_flushed(uint64_t pos)
+{
+    const auto discard = discard_pos.load(std::memory_order_acquire);
+    if (pos >= discard)
+        return pos;
+    for (; pos != discard; ++pos) {
+        auto& pkt = pkt_buf[pos & capacity_mask];
+        take_one(pkt);
+        pkt.unref();
+    }
+    head.store(pos, std::memory_order_release);
+    return pos;
 }
 
 void PacketQueue::abort()
 {
+    abort_req = true;
     std::scoped_lock lck(mutex);
-    ext_abort_req = int_abort_req = true;
-    cond.notify_one();
+    cond.notify_all();
 }
 
 void PacketQueue::start()
 {
-    std::scoped_lock lck(mutex);
-    ext_abort_req = int_abort_req = false;
-    ++ext_serial;
-    ++int_serial;
+    abort_req = false;
+    ++serial_val;
 }
 
 /* return < 0 if aborted, 0 if no packet and > 0 if packet.  */
 int PacketQueue::get(CAVPacket& dst, bool block)
 {
-    std::unique_lock lck(mutex);
-
-    int ret = 0;
+    const auto pos = drop_flushed(head.load(std::memory_order_relaxed));
     for (;;) {
-        if (int_abort_req) {
-            ret = -1;
-            break;
-        }
-
-        if (!pkt_buf.empty()) {
-            CAVPacket pkt = std::move(pkt_buf.front());
-            pkt_buf.pop();
-            --nb_packets;
-            byte_size -= pkt.size();
-            duration_s -= pkt.dur();
-            dst = std::move(pkt);
-            ret = 1;
+        if (abort_req.load(std::memory_order_relaxed))
+            return -1;
+
+        if (tail.load(std::memory_order_acquire) != pos)
             break;
-        } else if (!block) {
-            ret = 0;
+
+        if (!block)
+            return 0;
+
+        std::unique_lock lck(mutex);
+        consumer_waiting = true;
+        cond.wait(lck, [&]{return abort_req.load() || tail.load() != pos;});
+        consumer_waiting = false;
+    }
+
+    auto& pkt = pkt_buf[pos & capacity_mask];
+    take_one(pkt);
+    dst = std::move(pkt);
+    head.store(pos + 1, std::memory_order_release);
+    maybe_wake_producer();
+
+    return 1;
+}
+
+int PacketQueue::get(std::vector<CAVPacket>& dst, int max_count, bool block)
+{
+    int taken = 0;
+    CAVPacket pkt;
+    while (taken < max_count) {
+        const int ret = get(pkt, block && taken == 0);
+        if (ret < 0)
+            return ret;
+        if (ret == 0)
             break;
-        } else {
-            cond.wait(lck);
-        }
+        dst.push_back(std::move(pkt));
+        ++taken;
     }
 
-    return ret;
+    return taken;
 }
 
-std::tuple<int, int, double> PacketQueue::getParams(){
-    std::scoped_lock lck(mutex);
-    return {byte_size, nb_packets, duration_s};
+std::tuple<int, int, double> PacketQueue::getParams() const{
+    const auto out_b = bytes_out.load(), out_p = pkts_out.load();
+    const auto out_d = dur_out_us.load();
+    const auto in_b = bytes_in.load(), in_p = pkts_in.load();
+    const auto in_d = dur_in_us.load();
+
+    const auto byte_size = in_b - out_b;
+    const auto nb_packets = in_p - out_p;
+    const auto dur_us = in_d - out_d;
+    return {static_cast<int>(byte_size), static_cast<int>(nb_packets), std::max<int64_t>(dur_us, 0) / 1000000.0};
 }
 
 int PacketQueue::serial() const{
-    return ext_serial.load();
+    return serial_val.load();
 }
 
 bool PacketQueue::isAborted() const{
-    return ext_abort_req.load();
+    return abort_req.load();
 }
 
 bool PacketQueue::isEmpty() const{
-    std::scoped_lock lck(mutex);
-    return pkt_buf.empty();
+    return tail.load() == head.load();
+}
+
+bool PacketQueue::isFull() const{
+    return tail.load() - head.load() > capacity_mask; /*the bound of push_one()*/
 }
 
 int PacketQueue::size() const{
-    return byte_size;
+    return std::get<0>(getParams());
 }
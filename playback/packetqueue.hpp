@@ -1,7 +1,8 @@
 #ifndef PACKETQUEUE_HPP
 #define PACKETQUEUE_HPP
 
-#include <queue>
+#include <vector>
+#include <tuple>
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
@@ -9,37 +10,76 @@
 #include <QtGlobal>
 
 #include "cavpacket.hpp"
+#include "wakeupevent.hpp"
 
+#define PACKET_QUEUE_CAPACITY 8192 /*must be a power of 2*/
+
+/* Bounded single-producer/single-consumer packet queue. The demuxer thread is the only
+ * producer(put, flush, start) and the decoder thread is the only consumer(get).
+ * The indices and statistics are atomic, so neither side takes a lock unless the consumer
+ * has to sleep on an empty queue. */
 class PacketQueue
 {
     Q_DISABLE_COPY_MOVE(PacketQueue);
 private:
-    std::queue<CAVPacket> pkt_buf;
-    double duration_s = 0.0;
-    int byte_size = 0, nb_packets = 0;
-    int int_serial = -1;
-    std::atomic<int> ext_serial = int_serial;
-    bool int_abort_req = true;
-    std::atomic_bool ext_abort_req = int_abort_req;
-
-    mutable std::mutex mutex;
+    std::vector<CAVPacket> pkt_buf;
+    const uint64_t capacity_mask;
+
+    alignas(64) std::atomic<uint64_t> head = 0; /*written by the consumer only*/
+    alignas(64) std::atomic<uint64_t> tail = 0; /*written by the producer only*/
+    std::atomic<uint64_t> discard_pos = 0; /*written by the producer only, the packets before it were flushed*/
+
+    /*Cumulative counters. The live statistics are computed as the difference between
+     * what has been put and what has been taken out(or dropped) of the queue.*/
+    std::atomic<uint64_t> bytes_in = 0, pkts_in = 0;
+    std::atomic<int64_t> dur_in_us = 0;
+    std::atomic<uint64_t> bytes_out = 0, pkts_out = 0;
+    std::atomic<int64_t> dur_out_us = 0;
+
+    /*The producer is woken up whenever the consumer takes a packet while the queue is below this mark*/
+    WakeupEvent& producer_wakeup;
+    std::atomic<int> low_water_pkts = 0, low_water_bytes = 0;
+    std::atomic<double> low_water_dur = 0.0;
+
+    std::atomic<int> serial_val = -1;
+    std::atomic_bool abort_req = true;
+
+    /*Only used to sleep when the queue is empty*/
+    std::atomic_bool consumer_waiting = false;
+    std::mutex mutex;
     std::condition_variable cond;
 
+    bool push_one(CAVPacket&& pkt, uint64_t pos);
+    void take_one(CAVPacket& pkt);
+    uint64_t drop_flushed(uint64_t pos);
+    void wake_consumer();
+    void maybe_wake_producer();
+
 public:
-    PacketQueue();
+    PacketQueue(WakeupEvent& producer_wakeup, int capacity = PACKET_QUEUE_CAPACITY);
+
+    /*The queue is considered to be running low if it holds less than dur_s seconds.
+     * If the packet durations are unknown, less than bytes(if non-zero) or nb_pkts is used instead*/
+    void setLowWaterMark(int nb_pkts, double dur_s, int bytes);
 
     bool put(CAVPacket&& pkt);
+    /*Puts up to count packets at once, returns the number of packets queued*/
+    int put(CAVPacket* pkts, int count);
     bool put_nullpacket(int stream_index);
     void flush();
     void abort();
     void start();
     /* return < 0 if aborted, 0 if no packet and > 0 if packet.  */
     int get(CAVPacket& dst, bool block);
+    /*Takes up to max_count packets at once and appends them to dst.
+     * Returns < 0 if aborted, otherwise the number of packets taken*/
+    int get(std::vector<CAVPacket>& dst, int max_count, bool block);
     /*returns the size, number of packets stored and duration of the queue*/
-    std::tuple<int, int, double> getParams();
+    std::tuple<int, int, double> getParams() const;
     int serial() const;
     bool isAborted() const;
     bool isEmpty() const;
+    bool isFull() const;
     int size() const;
 };
 
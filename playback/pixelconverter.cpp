@@ -0,0 +1,509 @@
+#include "pixelconverter.hpp"
+#include "clock.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+extern "C"{
+#include <libavutil/cpu.h>
+#include <libavutil/imgutils.h>
+#include <libavutil/pixdesc.h>
+}
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define PIXCONV_X86 1
+#include <immintrin.h>
+#else
+#define PIXCONV_X86 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define PIXCONV_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PIXCONV_TARGET(isa)
+#endif
+
+/* the converted pictures are aligned for the widest vector loads of SDL and the drivers */
+#define PIXCONV_ALIGN 64
+#define PIXCONV_MAX_THREADS 4
+/* below this many(chroma) rows per slice the threads cost more than they save */
+#define PIXCONV_MIN_SLICE_ROWS 64
+
+/* The row kernels. n is the number of output samples, sw the width of the source row for the
+ * horizontal halving, the shifts align the high bit depth samples. */
+struct Kernels {
+    void (*lshift16)(const uint16_t *s, uint16_t *d, int n, int sh);
+    void (*to8)(const uint16_t *s, uint8_t *d, int n, int sh);
+    void (*interleave8)(const uint8_t *u, const uint8_t *v, uint8_t *d, int n);
+    void (*interleave16)(const uint16_t *u, const uint16_t *v, uint16_t *d, int n, int sh);
+    void (*avg_rows8)(const uint8_t *a, const uint8_t *b, uint8_t *d, int n);
+    void (*avg_rows16)(const uint16_t *a, const uint16_t *b, uint16_t *d, int n);
+    void (*halve8)(const uint8_t *s, uint8_t *d, int n, int sw);
+    void (*halve16)(const uint16_t *s, uint16_t *d, int n, int sw);
+    void (*pack_gbr)(const uint8_t *g, const uint8_t *b, const uint8_t *r, uint32_t *d, int n);
+    const char* name;
+};
+
+static void lshift16_c(const uint16_t *s, uint16_t *d, int n, int sh)
+{
+    for (int i = 0; i < n; i++)
+        d[i] = uint16_t(s[i] << sh);
+}
+
+static void to8_c(const uint16_t *s, uint8_t *d, int n, int sh)
+{
+    for (int i = 0; i < n; i++)
+        d[i] = uint8_t(std::min(s[i] >> sh, 255));
+}
+
+static void interleave8_c(const uint8_t *u, const uint8_t *v, uint8_t *d, int n)
+{
+    for (int i = 0; i < n; i++) {
+        d[2 * i]     = u[i];
+        d[2 * i + 1] = v[i];
+    }
+}
+
+static void interleave16_c(const uint16_t *u, const uint16_t *v, uint16_t *d, int n, int sh)
+{
+    for (int i = 0; i < n; i++) {
+        d[2 * i]     = uint16_t(u[i] << sh);
+        d[2 * i + 1] = uint16_t(v[i] << sh);
+    }
+}
+
+static void avg_rows8_c(const uint8_t *a, const uint8_t *b, uint8_t *d, int n)
+{
+    for (int i = 0; i < n; i++)
+        d[i] = uint8_t((a[i] + b[i] + 1) >> 1);
+}
+
+static void avg_rows16_c(const uint16_t *a, const uint16_t *b, uint16_t *d, int n)
+{
+    for (int i = 0; i < n; i++)
+        d[i] = uint16_t((a[i] + b[i] + 1) >> 1);
+}
+
+static void halve8_c(const uint8_t *s, uint8_t *d, int n, int sw)
+{
+    for (int i = 0; i < n; i++)
+        d[i] = uint8_t((s[2 * i] + s[std::min(2 * i + 1, sw - 1)] + 1) >> 1);
+}
+
+static void halve16_c(const uint16_t *s, uint16_t *d, int n, int sw)
+{
+    for (int i = 0; i < n; i++)
+        d[i] = uint16_t((s[2 * i] + s[std::min(2 * i + 1, sw - 1)] + 1) >> 1);
+}
+
+static void pack_gbr_c(const uint8_t *g, const uint8_t *b, const uint8_t *r, uint32_t *d, int n)
+{
+    for (int i = 0; i < n; i++)
+        d[i] = 0xFF000000u | uint32_t(r[i]) << 16 | uint32_t(g[i]) << 8 | b[i];
+}
+
+#if PIXCONV_X86
+PIXCONV_TARGET("sse2")
+static void lshift16_sse2(const uint16_t *s, uint16_t *d, int n, int sh)
+{
+    const __m128i cnt = _mm_cvtsi32_si128(sh);
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i*)(d + i), _mm_sll_epi16(_mm_loadu_si128((const __m128i*)(s + i)), cnt));
+    lshift16_c(s + i, d + i, n - i, sh);
+}
+
+PIXCONV_TARGET("sse2")
+static void to8_sse2(const uint16_t *s, uint8_t *d, int n, int sh)
+{
+    const __m128i cnt = _mm_cvtsi32_si128(sh);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i a = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(s + i)), cnt);
+        const __m128i b = _mm_srl_epi16(_mm_loadu_si128((const __m128i*)(s + i + 8)), cnt);
+        _mm_storeu_si128((__m128i*)(d + i), _mm_packus_epi16(a, b));
+    }
+    to8_c(s + i, d + i, n - i, sh);
+}
+
+PIXCONV_TARGET("sse2")
+static void interleave8_sse2(const uint8_t *u, const uint8_t *v, uint8_t *d, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i a = _mm_loadu_si128((const __m128i*)(u + i));
+        const __m128i b = _mm_loadu_si128((const __m128i*)(v + i));
+        _mm_storeu_si128((__m128i*)(d + 2 * i), _mm_unpacklo_epi8(a, b));
+        _mm_storeu_si128((__m128i*)(d + 2 * i + 16), _mm_unpackhi_epi8(a, b));
+    }
+    interleave8_c(u + i, v + i, d + 2 * i, n - i);
+}
+
+PIXCONV_TARGET("sse2")
+static void interleave16_sse2(const uint16_t *u, const uint16_t *v, uint16_t *d, int n, int sh)
+{
+    const __m128i cnt = _mm_cvtsi32_si128(sh);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const __m128i a = _mm_sll_epi16(_mm_loadu_si128((const __m128i*)(u + i)), cnt);
+        const __m128i b = _mm_sll_epi16(_mm_loadu_si128((const __m128i*)(v + i)), cnt);
+        _mm_storeu_si128((__m128i*)(d + 2 * i), _mm_unpacklo_epi16(a, b));
+        _mm_storeu_si128((__m128i*)(d + 2 * i + 8), _mm_unpackhi_epi16(a, b));
+    }
+    interleave16_c(u + i, v + i, d + 2 * i, n - i, sh);
+}
+
+PIXCONV_TARGET("sse2")
+static void avg_rows8_sse2(const uint8_t *a, const uint8_t *b, uint8_t *d, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm_storeu_si128((__m128i*)(d + i), _mm_avg_epu8(_mm_loadu_si128((const __m128i*)(a + i)),
+                                                         _mm_loadu_si128((const __m128i*)(b + i))));
+    avg_rows8_c(a + i, b + i, d + i, n - i);
+}
+
+PIXCONV_TARGET("sse2")
+static void avg_rows16_sse2(const uint16_t *a, const uint16_t *b, uint16_t *d, int n)
+{
+    int i = 0;
+    for (; i + 8 <= n; i += 8)
+        _mm_storeu_si128((__m128i*)(d + i), _mm_avg_epu16(_mm_loadu_si128((const __m128i*)(a + i)),
+                                                          _mm_loadu_si128((const __m128i*)(b + i))));
+    avg_rows16_c(a + i, b + i, d + i, n - i);
+}
+
+PIXCONV_TARGET("sse2")
+static void halve8_sse2(const uint8_t *s, uint8_t *d, int n, int sw)
+{
+    const __m128i low = _mm_set1_epi16(0x00FF);
+    int i = 0;
+    for (; i + 16 <= n && 2 * (i + 16) <= sw; i += 16) {
+        const __m128i x0 = _mm_loadu_si128((const __m128i*)(s + 2 * i));
+        const __m128i x1 = _mm_loadu_si128((const __m128i*)(s + 2 * i + 16));
+        const __m128i a0 = _mm_avg_epu16(_mm_and_si128(x0, low), _mm_srli_epi16(x0, 8));
+        const __m128i a1 = _mm_avg_epu16(_mm_and_si128(x1, low), _mm_srli_epi16(x1, 8));
+        _mm_storeu_si128((__m128i*)(d + i), _mm_packus_epi16(a0, a1));
+    }
+    halve8_c(s + 2 * i, d + i, n - i, sw - 2 * i);
+}
+
+PIXCONV_TARGET("sse2")
+static void halve16_sse2(const uint16_t *s, uint16_t *d, int n, int sw)
+{
+    const __m128i low = _mm_set1_epi32(0x0000FFFF);
+    int i = 0;
+    for (; i + 8 <= n && 2 * (i + 8) <= sw; i += 8) {
+        const __m128i x0 = _mm_loadu_si128((const __m128i*)(s + 2 * i));
+        const __m128i x1 = _mm_loadu_si128((const __m128i*)(s + 2 * i + 8));
+        const __m128i a0 = _mm_avg_epu16(_mm_and_si128(x0, low), _mm_srli_epi32(x0, 16));
+        const __m128i a1 = _mm_avg_epu16(_mm_and_si128(x1, low), _mm_srli_epi32(x1, 16));
+        /*the samples have at most 12 bits, the signed saturation never kicks in*/
+        _mm_storeu_si128((__m128i*)(d + i), _mm_packs_epi32(a0, a1));
+    }
+    halve16_c(s + 2 * i, d + i, n - i, sw - 2 * i);
+}
+
+PIXCONV_TARGET("sse2")
+static void pack_gbr_sse2(const uint8_t *g, const uint8_t *b, const uint8_t *r, uint32_t *d, int n)
+{
+    const __m128i alpha = _mm_set1_epi8(-1);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m128i gv = _mm_loadu_si128((const __m128i*)(g + i));
+        const __m128i bv = _mm_loadu_si128((const __m128i*)(b + i));
+        const __m128i rv = _mm_loadu_si128((const __m128i*)(r + i));
+        /*B G R X in memory, XRGB8888 on little endian*/
+        const __m128i bg_lo = _mm_unpacklo_epi8(bv, gv), bg_hi = _mm_unpackhi_epi8(bv, gv);
+        const __m128i ra_lo = _mm_unpacklo_epi8(rv, alpha), ra_hi = _mm_unpackhi_epi8(rv, alpha);
+        _mm_storeu_si128((__m128i*)(d + i),      _mm_unpacklo_epi16(bg_lo, ra_lo));
+        _mm_storeu_si128((__m128i*)(d + i + 4),  _mm_unpackhi_epi16(bg_lo, ra_lo));
+        _mm_storeu_si128((__m128i*)(d + i + 8),  _mm_unpacklo_epi16(bg_hi, ra_hi));
+        _mm_storeu_si128((__m128i*)(d + i + 12), _mm_unpackhi_epi16(bg_hi, ra_hi));
+    }
+    pack_gbr_c(g + i, b + i, r + i, d + i, n - i);
+}
+
+/* The 256 bit unpacks and packs work within each 128 bit half, so the qwords are reordered
+ * around them(0xD8: 0, 2, 1, 3) to keep the samples in sequence */
+PIXCONV_TARGET("avx2")
+static void lshift16_avx2(const uint16_t *s, uint16_t *d, int n, int sh)
+{
+    const __m128i cnt = _mm_cvtsi32_si128(sh);
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm256_storeu_si256((__m256i*)(d + i), _mm256_sll_epi16(_mm256_loadu_si256((const __m256i*)(s + i)), cnt));
+    lshift16_c(s + i, d + i, n - i, sh);
+}
+
+PIXCONV_TARGET("avx2")
+static void to8_avx2(const uint16_t *s, uint8_t *d, int n, int sh)
+{
+    const __m128i cnt = _mm_cvtsi32_si128(sh);
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i a = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i*)(s + i)), cnt);
+        const __m256i b = _mm256_srl_epi16(_mm256_loadu_si256((const __m256i*)(s + i + 16)), cnt);
+        _mm256_storeu_si256((__m256i*)(d + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8));
+    }
+    to8_c(s + i, d + i, n - i, sh);
+}
+
+PIXCONV_TARGET("avx2")
+static void interleave8_avx2(const uint8_t *u, const uint8_t *v, uint8_t *d, int n)
+{
+    int i = 0;
+    for (; i + 32 <= n; i += 32) {
+        const __m256i a = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*)(u + i)), 0xD8);
+        const __m256i b = _mm256_permute4x64_epi64(_mm256_loadu_si256((const __m256i*)(v + i)), 0xD8);
+        _mm256_storeu_si256((__m256i*)(d + 2 * i), _mm256_unpacklo_epi8(a, b));
+        _mm256_storeu_si256((__m256i*)(d + 2 * i + 32), _mm256_unpackhi_epi8(a, b));
+    }
+    interleave8_c(u + i, v + i, d + 2 * i, n - i);
+}
+
+PIXCONV_TARGET("avx2")
+static void interleave16_avx2(const uint16_t *u, const uint16_t *v, uint16_t *d, int n, int sh)
+{
+    const __m128i cnt = _mm_cvtsi32_si128(sh);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        const __m256i a = _mm256_permute4x64_epi64(_mm256_sll_epi16(_mm256_loadu_si256((const __m256i*)(u + i)), cnt), 0xD8);
+        const __m256i b = _mm256_permute4x64_epi64(_mm256_sll_epi16(_mm256_loadu_si256((const __m256i*)(v + i)), cnt), 0xD8);
+        _mm256_storeu_si256((__m256i*)(d + 2 * i), _mm256_unpacklo_epi16(a, b));
+        _mm256_storeu_si256((__m256i*)(d + 2 * i + 16), _mm256_unpackhi_epi16(a, b));
+    }
+    interleave16_c(u + i, v + i, d + 2 * i, n - i, sh);
+}
+
+PIXCONV_TARGET("avx2")
+static void avg_rows8_avx2(const uint8_t *a, const uint8_t *b, uint8_t *d, int n)
+{
+    int i = 0;
+    for (; i + 32 <= n; i += 32)
+        _mm256_storeu_si256((__m256i*)(d + i), _mm256_avg_epu8(_mm256_loadu_si256((const __m256i*)(a + i)),
+                                                               _mm256_loadu_si256((const __m256i*)(b + i))));
+    avg_rows8_c(a + i, b + i, d + i, n - i);
+}
+
+PIXCONV_TARGET("avx2")
+static void avg_rows16_avx2(const uint16_t *a, const uint16_t *b, uint16_t *d, int n)
+{
+    int i = 0;
+    for (; i + 16 <= n; i += 16)
+        _mm256_storeu_si256((__m256i*)(d + i), _mm256_avg_epu16(_mm256_loadu_si256((const __m256i*)(a + i)),
+                                                                _mm256_loadu_si256((const __m256i*)(b + i))));
+    avg_rows16_c(a + i, b + i, d + i, n - i);
+}
+#endif
+
+static Kernels select_kernels(int flags)
+{
+    Kernels k = {lshift16_c, to8_c, interleave8_c, interleave16_c, avg_rows8_c, avg_rows16_c,
+                 halve8_c, halve16_c, pack_gbr_c, "C"};
+#if PIXCONV_X86
+    if (flags & AV_CPU_FLAG_SSE2) {
+        k = {lshift16_sse2, to8_sse2, interleave8_sse2, interleave16_sse2, avg_rows8_sse2, avg_rows16_sse2,
+             halve8_sse2, halve16_sse2, pack_gbr_sse2, "SSE2"};
+    }
+    /*the halving and the packing of RGB are shuffle bound, SSE2 does as well there*/
+    if (flags & AV_CPU_FLAG_AVX2) {
+        k.lshift16 = lshift16_avx2;
+        k.to8 = to8_avx2;
+        k.interleave8 = interleave8_avx2;
+        k.interleave16 = interleave16_avx2;
+        k.avg_rows8 = avg_rows8_avx2;
+        k.avg_rows16 = avg_rows16_avx2;
+        k.name = "AVX2";
+    }
+#endif
+    return k;
+}
+
+/* the best kernels the cpu flags allow */
+static const Kernels& kernels(int flags)
+{
+    static const Kernels k_c = select_kernels(0), k_sse2 = select_kernels(AV_CPU_FLAG_SSE2),
+                         k_avx2 = select_kernels(AV_CPU_FLAG_SSE2 | AV_CPU_FLAG_AVX2);
+    if ((flags & AV_CPU_FLAG_AVX2) && (flags & AV_CPU_FLAG_SSE2))
+        return k_avx2;
+    if (flags & AV_CPU_FLAG_SSE2)
+        return k_sse2;
+    return k_c;
+}
+
+/* One output(4:2:0) row of a chroma plane: the source rows are averaged for 4:2:2 and 4:4:4,
+ * and the samples halved horizontally for 4:4:4 */
+template<class T>
+static const T* chroma_row(const AVFrame *src, const AVPixFmtDescriptor *desc, int plane, int cy, T *avg_buf, T *half_buf,
+                           void (*avg_rows)(const T*, const T*, T*, int), void (*halve)(const T*, T*, int, int))
+{
+    const int scw = AV_CEIL_RSHIFT(src->width, desc->log2_chroma_w);
+    const int cw = AV_CEIL_RSHIFT(src->width, 1);
+    auto row = [src, plane](int y){return (const T*)(src->data[plane] + ptrdiff_t(y) * src->linesize[plane]);};
+
+    const T *line;
+    if (desc->log2_chroma_h) {
+        line = row(cy);
+    } else {
+        avg_rows(row(2 * cy), row(std::min(2 * cy + 1, src->height - 1)), avg_buf, scw);
+        line = avg_buf;
+    }
+    if (!desc->log2_chroma_w) {
+        halve(line, half_buf, cw, scw);
+        line = half_buf;
+    }
+    return line;
+}
+
+PixelConverter::PixelConverter(int flags) : workers(PIXCONV_MAX_THREADS), cpu_flags(flags < 0 ? av_get_cpu_flags() : flags)
+{
+    scratch.resize(workers.count());
+}
+
+PixelConverter::~PixelConverter()
+{
+    av_buffer_pool_uninit(&pool);
+}
+
+AVPixelFormat PixelConverter::outputFormat(AVPixelFormat src_fmt, const std::vector<AVPixelFormat>& supported)
+{
+    auto has = [&supported](AVPixelFormat fmt){return std::find(supported.begin(), supported.end(), fmt) != supported.end();};
+
+    switch (src_fmt) {
+    case AV_PIX_FMT_GBRP:
+        return has(AV_PIX_FMT_0RGB32) ? AV_PIX_FMT_0RGB32 : AV_PIX_FMT_NONE;
+    case AV_PIX_FMT_YUV420P9:
+    case AV_PIX_FMT_YUV420P10:
+    case AV_PIX_FMT_YUV420P12:
+    case AV_PIX_FMT_YUV422P10:
+    case AV_PIX_FMT_YUV422P12:
+    case AV_PIX_FMT_YUV444P10:
+    case AV_PIX_FMT_YUV444P12:
+        if (has(AV_PIX_FMT_P010))
+            return AV_PIX_FMT_P010;
+        [[fallthrough]];
+    case AV_PIX_FMT_YUV422P:
+    case AV_PIX_FMT_YUV444P:
+    case AV_PIX_FMT_YUVJ422P:
+    case AV_PIX_FMT_YUVJ444P:
+        if (has(AV_PIX_FMT_NV12))
+            return AV_PIX_FMT_NV12;
+        if (has(AV_PIX_FMT_YUV420P))
+            return AV_PIX_FMT_YUV420P;
+        return AV_PIX_FMT_NONE;
+    default:
+        return AV_PIX_FMT_NONE;
+    }
+}
+
+int PixelConverter::convert(const AVFrame *src, AVFrame *dst, AVPixelFormat dst_fmt)
+{
+    const double start = gettime();
+    const auto src_fmt = AVPixelFormat(src->format);
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(src_fmt);
+    const int w = src->width, h = src->height;
+    int ret;
+
+    const int size = av_image_get_buffer_size(dst_fmt, w, h, PIXCONV_ALIGN);
+    if (size < 0)
+        return size;
+    if (!pool || pool_size != size) {
+        av_buffer_pool_uninit(&pool);
+        if (!(pool = av_buffer_pool_init(size, NULL)))
+            return AVERROR(ENOMEM);
+        pool_size = size;
+    }
+
+    av_frame_unref(dst);
+    if (!(dst->buf[0] = av_buffer_pool_get(pool)))
+        return AVERROR(ENOMEM);
+    if ((ret = av_image_fill_arrays(dst->data, dst->linesize, dst->buf[0]->data, dst_fmt, w, h, PIXCONV_ALIGN)) < 0)
+        return ret;
+    dst->extended_data = dst->data;
+    dst->format = dst_fmt;
+    dst->width = w;
+    dst->height = h;
+    if ((ret = av_frame_copy_props(dst, src)) < 0)
+        return ret;
+    if ((src_fmt == AV_PIX_FMT_YUVJ422P || src_fmt == AV_PIX_FMT_YUVJ444P) && dst->color_range == AVCOL_RANGE_UNSPECIFIED)
+        dst->color_range = AVCOL_RANGE_JPEG;
+
+    const auto& k = kernels(cpu_flags);
+    const int cw = AV_CEIL_RSHIFT(w, 1);
+    for (auto& buf : scratch)
+        if (int(buf.size()) < 4 * w + 64)
+            buf.resize(4 * w + 64);
+
+    /*the slices are made of output chroma rows, so of pairs of luma rows*/
+    const int rows = src_fmt == AV_PIX_FMT_GBRP ? h : AV_CEIL_RSHIFT(h, 1);
+    const int count = std::clamp(rows / PIXCONV_MIN_SLICE_ROWS, 1, int(scratch.size()));
+    auto slice_rows = [rows, count](int slice){return std::make_pair(rows * slice / count, rows * (slice + 1) / count);};
+
+    auto dst_row = [dst](int plane, int y){return dst->data[plane] + ptrdiff_t(y) * dst->linesize[plane];};
+    auto src_row = [src](int plane, int y){return src->data[plane] + ptrdiff_t(y) * src->linesize[plane];};
+
+    if (src_fmt == AV_PIX_FMT_GBRP) {
+        workers.run(count, [&](int slice, int){
+            const auto [y0, y1] = slice_rows(slice);
+            for (int y = y0; y < y1; y++)
+                k.pack_gbr(src_row(0, y), src_row(1, y), src_row(2, y), (uint32_t*)dst_row(0, y), w);
+        });
+    } else if (desc->comp[0].depth > 8) {
+        const int depth = desc->comp[0].depth;
+        workers.run(count, [&](int slice, int worker){
+            uint16_t *tmp = scratch[worker].data();
+            uint8_t *u8 = (uint8_t*)(tmp + 3 * w + 2), *v8 = u8 + cw;
+            const auto [cy0, cy1] = slice_rows(slice);
+            for (int cy = cy0; cy < cy1; cy++) {
+                for (int y = 2 * cy; y < std::min(2 * cy + 2, h); y++) {
+                    if (dst_fmt == AV_PIX_FMT_P010)
+                        k.lshift16((const uint16_t*)src_row(0, y), (uint16_t*)dst_row(0, y), w, 16 - depth);
+                    else
+                        k.to8((const uint16_t*)src_row(0, y), dst_row(0, y), w, depth - 8);
+                }
+
+                const uint16_t *u = chroma_row<uint16_t>(src, desc, 1, cy, tmp, tmp + 2 * w, k.avg_rows16, k.halve16);
+                const uint16_t *v = chroma_row<uint16_t>(src, desc, 2, cy, tmp + w, tmp + 2 * w + cw, k.avg_rows16, k.halve16);
+                if (dst_fmt == AV_PIX_FMT_P010) {
+                    k.interleave16(u, v, (uint16_t*)dst_row(1, cy), cw, 16 - depth);
+                } else if (dst_fmt == AV_PIX_FMT_NV12) {
+                    k.to8(u, u8, cw, depth - 8);
+                    k.to8(v, v8, cw, depth - 8);
+                    k.interleave8(u8, v8, dst_row(1, cy), cw);
+                } else {
+                    k.to8(u, dst_row(1, cy), cw, depth - 8);
+                    k.to8(v, dst_row(2, cy), cw, depth - 8);
+                }
+            }
+        });
+    } else {
+        workers.run(count, [&](int slice, int worker){
+            uint8_t *tmp = (uint8_t*)scratch[worker].data();
+            const auto [cy0, cy1] = slice_rows(slice);
+            for (int cy = cy0; cy < cy1; cy++) {
+                for (int y = 2 * cy; y < std::min(2 * cy + 2, h); y++)
+                    memcpy(dst_row(0, y), src_row(0, y), w);
+
+                const uint8_t *u = chroma_row<uint8_t>(src, desc, 1, cy, tmp, tmp + 2 * w, k.avg_rows8, k.halve8);
+                const uint8_t *v = chroma_row<uint8_t>(src, desc, 2, cy, tmp + w, tmp + 2 * w + cw, k.avg_rows8, k.halve8);
+                if (dst_fmt == AV_PIX_FMT_NV12) {
+                    k.interleave8(u, v, dst_row(1, cy), cw);
+                } else {
+                    memcpy(dst_row(1, cy), u, cw);
+                    memcpy(dst_row(2, cy), v, cw);
+                }
+            }
+        });
+    }
+
+    ++frames;
+    time_sum += gettime() - start;
+    return 0;
+}
+
+int PixelConverter::threadCount() const{return int(scratch.size());}
+int PixelConverter::framesConverted() const{return frames;}
+double PixelConverter::avgTime() const{return frames ? time_sum / frames : 0.0;}
+const char* PixelConverter::kernelName() const{return kernels(cpu_flags).name;}
+const char* PixelConverter::simdName(){return kernels(av_get_cpu_flags()).name;}
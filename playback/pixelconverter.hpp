@@ -0,0 +1,54 @@
+#ifndef PIXELCONVERTER_HPP
+#define PIXELCONVERTER_HPP
+
+#include <vector>
+#include <cstdint>
+
+#include <QtGlobal>
+
+#include "sliceworkers.hpp"
+
+extern "C"{
+#include <libavutil/frame.h>
+#include <libavutil/buffer.h>
+}
+
+/* Converts the decoded frames the renderer has no texture format for into the closest one it has,
+ * without going through the filter graph and swscale: 4:2:2 and 4:4:4 to 4:2:0, high bit depth
+ * YUV to P010(or 8 bits), planar RGB to XRGB. The rows are converted by SSE2/AVX2 kernels picked
+ * from the CPU flags at runtime, and the picture is split in slices converted in parallel. */
+class PixelConverter final
+{
+    Q_DISABLE_COPY_MOVE(PixelConverter);
+
+    SliceWorkers workers;
+    const int cpu_flags; /*pick the row kernels*/
+
+    /*intermediate chroma rows, per worker*/
+    std::vector<std::vector<uint16_t>> scratch;
+
+    AVBufferPool* pool = nullptr;
+    int pool_size = 0;
+
+    int frames = 0;
+    double time_sum = 0.0;
+
+public:
+    /*cpu_flags: the AV_CPU_FLAG_* the kernels may use, -1 for those of the CPU*/
+    explicit PixelConverter(int cpu_flags = -1);
+    ~PixelConverter();
+
+    /*The format src_fmt is converted to among the supported ones, AV_PIX_FMT_NONE if it can't be*/
+    static AVPixelFormat outputFormat(AVPixelFormat src_fmt, const std::vector<AVPixelFormat>& supported);
+    /*dst gets a pooled buffer with the picture in dst_fmt, and the properties of src*/
+    int convert(const AVFrame *src, AVFrame *dst, AVPixelFormat dst_fmt);
+
+    int threadCount() const;
+    int framesConverted() const;
+    double avgTime() const; /*per frame, in seconds*/
+    const char* kernelName() const;
+    /*of the kernels picked for the CPU*/
+    static const char* simdName();
+};
+
+#endif // PIXELCONVERTER_HPP
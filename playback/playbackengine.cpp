@@ -6,15 +6,19 @@
 #include "audiotrack.hpp"
 #include "videotrack.hpp"
 #include "subtrack.hpp"
+#include "buffercontroller.hpp"
+#include "packetcache.hpp"
+#include "keyframeindex.hpp"
+#include "thumbnailer.hpp"
+#include "threadingpolicy.hpp"
+#include "../src/utils.hpp"
 
 #include <QApplication>
+#include <QThread>
 #include <cstdarg>
 
 #include <SDL3/SDL.h>
 
-#define MAX_QUEUE_SIZE (15 * 1024 * 1024)
-#define MIN_FRAMES 25
-
 /* no AV sync correction is done if below the minimum AV sync threshold */
 #define AV_SYNC_THRESHOLD_MIN 0.04
 /* AV sync correction is done if above the maximum AV sync threshold */
@@ -24,11 +28,22 @@
 /* no AV correction is done if too big error */
 #define AV_NOSYNC_THRESHOLD 10.0
 
+/* maximum audio speed change to get correct sync */
+#define SAMPLE_CORRECTION_PERCENT_MAX 10
+/* we use about AUDIO_DIFF_AVG_NB A-V differences to make the average */
+#define AUDIO_DIFF_AVG_NB 20
+#define AUDIO_DIFF_AVG_COEF exp(log(0.01) / AUDIO_DIFF_AVG_NB)
+
 /* polls for possible required screen refresh at least this often, should be less than 1/fps */
 #define REFRESH_RATE 0.01
-#define SDL_AUDIO_BUFLEN 0.2 /*in seconds*/
+/* the audio feeder checks for new frames at least this often, in seconds */
+#define AUDIO_FEED_INTERVAL 0.005
+/* the presentation thread posts the position to the GUI at most this often */
+#define GUI_UPDATE_INTERVAL 0.05
 
 void read_thread(PlayerContext&);
+static void render_thread(PlayerContext&);
+static void audio_thread(PlayerContext&);
 
 struct PlayerContext {
     Q_DISABLE_COPY_MOVE(PlayerContext);
@@ -37,8 +52,25 @@ struct PlayerContext {
     AudioOutput aout;
     AudioResampler acvt;
     PlayerCore& core;
+    BufferController buffering; /*accessed by the demuxer thread only*/
+    PacketCache pkt_cache; /*accessed by the demuxer thread only*/
+    const ThreadingPolicy threading;
+    std::unique_ptr<KeyframeIndex> kf_index; /*accessed by the demuxer thread only*/
+    int kf_index_hits = 0;
 
     std::mutex render_mutex; /*guards each iteration of the refresh loop*/
+    WakeupEvent render_wakeup; /*wakes the presentation thread before its next deadline*/
+    std::unique_ptr<QThread> render_thr;
+    std::thread audio_thr;
+    std::mutex audio_mutex; /*guards the audio track against the feeder thread, taken after render_mutex*/
+    double audio_clock_time = NAN; /*of the last played clock applied to the audio track*/
+    std::atomic<int> pause_toggle_req = 0; /*from the GUI, applied by the presentation thread*/
+    const int sync_master;
+    Clock extclk; /*follows the tracks, until they drift too far from it*/
+    /*the difference between the audio and a master clock that isn't the audio, averaged over the clock updates*/
+    double audio_diff_cum = 0.0;
+    int audio_diff_avg_count = 0;
+    std::atomic<double> audio_sync_diff = 0.0; /*what the feeder corrects by stretching the frames, 0 when in sync*/
     double stream_duration = 0.0;
     bool streams_updated = false;
     std::vector<CAVStream> streams;
@@ -51,7 +83,7 @@ struct PlayerContext {
     bool flush_playback = false;
     std::string url;
     std::mutex demux_mutex;
-    std::condition_variable continue_read_thread;
+    WakeupEvent demux_wakeup; /*signalled on seek/stream switch/pause requests and by draining queues*/
 
     std::unique_ptr<AudioTrack> atrack;
     std::unique_ptr<VideoTrack> vtrack;
@@ -62,19 +94,38 @@ struct PlayerContext {
 
     bool paused = false;
     int frame_drops_late = 0;
+    /*the pictures shown from a texture uploaded ahead, and how long before their display*/
+    int frames_preloaded = 0, frames_shown = 0;
+    double preload_slack_sum = 0.0, preload_slack_min = INFINITY;
+    /*distance between the pictures and the audio clock when they are shown*/
+    int av_sync_frames = 0;
+    double av_sync_err_sum = 0.0, av_sync_err_max = 0.0;
     double frame_timer = 0.0;
     double max_frame_duration = 0.0;      // maximum duration of a frame - above this, we consider the jump a timestamp discontinuity
     bool step = false;
 
     PlayerContext() = delete;
     PlayerContext(std::string _url, SDLRenderer& renderer, PlayerCore& c) :
-        url(_url), sdl_renderer(renderer), core(c){
+        url(_url), sdl_renderer(renderer), aout(c.options().audio_output_buffer_ms / 1000.0, c.options().audio_output_buffer_min_ms / 1000.0,
+                                                 c.options().audio_output_buffer_max_ms / 1000.0), core(c), buffering(c.options()),
+        pkt_cache(int64_t(c.options().seek_cache_mb) * 1024 * 1024), threading(c.options()), sync_master(c.options().sync_master){
         read_thr = std::thread(read_thread, std::ref(*this));
+
+        sdl_renderer.releaseContext();
+        sdl_renderer.setPresenter([this]{render_wakeup.signal();});
+        render_thr.reset(QThread::create([this]{render_thread(*this);}));
+        render_thr->start(QThread::HighestPriority);
+        audio_thr = std::thread(audio_thread, std::ref(*this));
     }
 
     ~PlayerContext(){
-        sdl_renderer.clearDisplay();
         abort_request = true;
+        render_wakeup.signal();
+        render_thr->wait();
+        audio_thr.join();
+        sdl_renderer.setPresenter(nullptr);
+        sdl_renderer.clearDisplay();
+        demux_wakeup.signal();
         if(read_thr.joinable())
             read_thr.join();
     }
@@ -98,8 +149,37 @@ static void video_image_display(PlayerContext& ctx, const CAVFrame& vp)
         }
     }
 
-    ctx.sdl_renderer.updateVideoTexture(AVFrameView(*vp.constAv()));
+    /*the delay the upload adds to the display, none if the picture was uploaded ahead*/
+    const double upload_start = gettime();
+    const double slack = vp.isUploaded() ? ctx.sdl_renderer.showPreloaded(&vp) : NAN;
+    if (!isnan(slack)) {
+        ctx.frames_preloaded++;
+        ctx.preload_slack_sum += slack;
+        ctx.preload_slack_min = std::min(ctx.preload_slack_min, slack);
+    } else {
+        ctx.sdl_renderer.updateVideoTexture(AVFrameView(*vp.constAv(), vp.orientation()));
+    }
+    ctx.frames_shown++;
+    ctx.vtrack->reportUploadTime(gettime() - upload_start);
     ctx.sdl_renderer.refreshDisplay();
+
+    if (ctx.atrack && !ctx.paused) {
+        const double err = fabs(vp.ts() - ctx.atrack->getClockVal());
+        if (!isnan(err) && err < AV_NOSYNC_THRESHOLD) {
+            ctx.av_sync_frames++;
+            ctx.av_sync_err_sum += err;
+            ctx.av_sync_err_max = std::max(ctx.av_sync_err_max, err);
+        }
+    }
+}
+
+/* Uploads the next picture while waiting for its deadline, so that showing it is only a texture swap */
+static void preload_picture(PlayerContext& ctx, CAVFrame& vp)
+{
+    if (vp.isUploaded())
+        return;
+    if (ctx.sdl_renderer.preloadVideoTexture(AVFrameView(*vp.constAv(), vp.orientation()), &vp))
+        vp.setUploaded(true);
 }
 
 static void request_ao_change(PlayerContext& ctx, int new_freq, int new_chn){
@@ -118,11 +198,16 @@ static void stream_component_close(PlayerContext& ctx, int stream_index, FormatC
     auto st = fmt_ctx.streamAt(stream_index);
     switch (st.codecPar().codec_type) {
     case AVMEDIA_TYPE_AUDIO:
+    {
+        std::scoped_lock lck(ctx.audio_mutex);
         ctx.atrack = nullptr;
+    }
+        ctx.buffering.setTrack(BufferController::TRACK_AUDIO, false, 0);
         ao_close(ctx);
         break;
     case AVMEDIA_TYPE_VIDEO:
         ctx.vtrack = nullptr;
+        ctx.buffering.setTrack(BufferController::TRACK_VIDEO, false, 0);
         break;
     case AVMEDIA_TYPE_SUBTITLE:
         ctx.strack = nullptr;
@@ -134,16 +219,41 @@ static void stream_component_close(PlayerContext& ctx, int stream_index, FormatC
     fmt_ctx.setStreamEnabled(stream_index, false);
 }
 
+static int get_master_sync_type(const PlayerContext& ctx)
+{
+    switch (ctx.sync_master) {
+    case PlayerOptions::SYNC_VIDEO:
+        if (ctx.vtrack)
+            return PlayerOptions::SYNC_VIDEO;
+        return ctx.atrack ? PlayerOptions::SYNC_AUDIO : PlayerOptions::SYNC_EXTERNAL;
+    case PlayerOptions::SYNC_AUDIO:
+        if (ctx.atrack)
+            return PlayerOptions::SYNC_AUDIO;
+        return ctx.vtrack ? PlayerOptions::SYNC_VIDEO : PlayerOptions::SYNC_EXTERNAL;
+    default:
+        return PlayerOptions::SYNC_EXTERNAL;
+    }
+}
+
 /* get the current master clock value */
 static double get_master_clock(PlayerContext& ctx)
 {
-    double clock = NAN;
-    if(ctx.atrack){
-        clock = ctx.atrack->getClockVal();
-    } else if(ctx.vtrack){
-        clock = ctx.vtrack->getClockVal();
+    switch (get_master_sync_type(ctx)) {
+    case PlayerOptions::SYNC_VIDEO:
+        return ctx.vtrack->getClockVal();
+    case PlayerOptions::SYNC_AUDIO:
+        return ctx.atrack->getClockVal();
+    default:
+        return ctx.extclk.get();
     }
-    return clock;
+}
+
+/* the external clock runs by itself, it only jumps to the tracks when unset or far from them */
+static void sync_external_clock(PlayerContext& ctx, double slave_clock)
+{
+    const double clock = ctx.extclk.get();
+    if (!isnan(slave_clock) && (isnan(clock) || fabs(clock - slave_clock) > AV_NOSYNC_THRESHOLD))
+        ctx.extclk.set(slave_clock);
 }
 
 /* pause or resume the video */
@@ -162,6 +272,8 @@ static void stream_toggle_pause(PlayerContext& ctx)
     if(ctx.atrack){
         ctx.atrack->setPauseStatus(ctx.paused);
     }
+    ctx.extclk.setPaused(ctx.paused);
+    ctx.aout.setPauseStatus(ctx.paused);
 }
 
 static void toggle_mute(PlayerContext& ctx)
@@ -179,10 +291,10 @@ static void step_to_next_frame(PlayerContext& ctx)
 static double compute_target_delay(double delay, PlayerContext& ctx)
 {
     /* update delay to follow master synchronisation source */
-    if (ctx.atrack) {
+    if (get_master_sync_type(ctx) != PlayerOptions::SYNC_VIDEO) {
         /* if video is slave, we try to correct big delays by
            duplicating or deleting a frame */
-        const auto diff = ctx.vtrack->getClockVal() - ctx.atrack->getClockVal();
+        const auto diff = ctx.vtrack->getClockVal() - get_master_clock(ctx);
 
         /* skip or repeat frame. We take into account the
            delay to compute the threshold. I still don't know
@@ -216,9 +328,14 @@ static double vp_duration(PlayerContext& ctx, const CAVFrame& vp, const CAVFrame
 static double video_refresh(PlayerContext& ctx)
 {
     double remaining_time = REFRESH_RATE;
+    /* the decoder drops the frames that are already late for the master clock */
+    const bool video_slave = get_master_sync_type(ctx) != PlayerOptions::SYNC_VIDEO;
+    ctx.vtrack->syncTo((video_slave && !ctx.paused && !ctx.step) ? get_master_clock(ctx) : NAN);
+    const auto output_size = ctx.sdl_renderer.outputSize();
+    ctx.vtrack->setDisplaySize(output_size.width(), output_size.height());
     while(ctx.vtrack->framesAvailable() > 0){
         const auto& lastvp = ctx.vtrack->getLastPicture();
-        const auto& vp = ctx.vtrack->peekCurrentPicture();
+        auto& vp = ctx.vtrack->peekCurrentPicture();
 
         if (vp.serial() != ctx.vtrack->serial()) {
             ctx.vtrack->nextFrame();
@@ -230,12 +347,16 @@ static double video_refresh(PlayerContext& ctx)
         if (flush)
             ctx.frame_timer = time;
 
-        if (ctx.paused && !flush) break;
+        if (ctx.paused && !flush) {
+            preload_picture(ctx, vp);
+            break;
+        }
 
         const auto last_duration = vp_duration(ctx, lastvp, vp);
         const auto delay = compute_target_delay(last_duration, ctx);
 
         if (time < ctx.frame_timer + delay) {
+            preload_picture(ctx, vp);
             remaining_time = std::min(ctx.frame_timer + delay - time, REFRESH_RATE);
             break;
         }
@@ -244,14 +365,17 @@ static double video_refresh(PlayerContext& ctx)
         if (delay > 0 && time - ctx.frame_timer > AV_SYNC_THRESHOLD_MAX)
             ctx.frame_timer = time;
 
-        if (!isnan(vp.ts()))
+        if (!isnan(vp.ts())) {
             ctx.vtrack->updateClock(vp.ts());
+            sync_external_clock(ctx, ctx.vtrack->getClockVal());
+        }
 
-        if (ctx.vtrack->framesAvailable() > 1 && ctx.atrack && !ctx.step) {
+        if (ctx.vtrack->framesAvailable() > 1 && video_slave && !ctx.step) {
             const auto& nextvp = ctx.vtrack->peekNextPicture();
             const auto duration = vp_duration(ctx, vp, nextvp);
             if(time > ctx.frame_timer + duration){
                 ctx.frame_drops_late++;
+                ctx.vtrack->reportLateDrop();
                 ctx.vtrack->nextFrame();
                 continue;
             }
@@ -279,6 +403,20 @@ static double video_refresh(PlayerContext& ctx)
     return remaining_time;
 }
 
+/* The reduced resolution decoding that still outputs at least the size of the screen, so the
+ * picture stays sharp whatever the window size. The codec may support less of it, or none */
+static int lowres_for_screen(const CAVStream& st, QSize screen)
+{
+    const int screen_max = std::max(screen.width(), screen.height());
+    if (screen_max <= 0)
+        return 0;
+
+    int lowres = 0;
+    while (lowres < 3 && std::min(st.width(), st.height()) >> (lowres + 1) >= screen_max)
+        ++lowres;
+    return lowres;
+}
+
 /* open a given stream. Return 0 if OK */
 static int stream_component_open(PlayerContext& ctx, int stream_index, FormatContext& ic)
 {
@@ -290,15 +428,28 @@ static int stream_component_open(PlayerContext& ctx, int stream_index, FormatCon
 
     switch (codecpar.codec_type) {
     case AVMEDIA_TYPE_AUDIO:
-        ctx.atrack = std::make_unique<AudioTrack>(st, ctx.continue_read_thread);
+    {
+        auto track = std::make_unique<AudioTrack>(st, ctx.demux_wakeup);
+        std::scoped_lock lck(ctx.audio_mutex);
+        ctx.atrack = std::move(track);
+    }
+        ctx.buffering.setTrack(BufferController::TRACK_AUDIO, true, codecpar.bit_rate);
         request_ao_change(ctx, codecpar.sample_rate, codecpar.ch_layout.nb_channels);
         break;
     case AVMEDIA_TYPE_VIDEO:
-        ctx.vtrack = std::make_unique<VideoTrack>(st, ctx.continue_read_thread, ctx.sdl_renderer.supportedFormats());
+    {
+        auto dec_cfg = ctx.threading.decoderConfig(st, ic.isRealtime());
+        if (ctx.core.options().display_downscale)
+            dec_cfg.lowres = lowres_for_screen(st, ctx.sdl_renderer.screenSize());
+        ctx.vtrack = std::make_unique<VideoTrack>(st, ctx.demux_wakeup, ctx.sdl_renderer.supportedFormats(),
+                                                  ctx.sdl_renderer.supportedColorSpaces(), ctx.core.options(),
+                                                  dec_cfg);
+        ctx.buffering.setTrack(BufferController::TRACK_VIDEO, !ctx.vtrack->isAttachedPic(), codecpar.bit_rate);
         ctx.queue_attachments_req = true;
+    }
         break;
     case AVMEDIA_TYPE_SUBTITLE:
-        ctx.strack = std::make_unique<SubTrack>(st, ctx.continue_read_thread);
+        ctx.strack = std::make_unique<SubTrack>(st, ctx.demux_wakeup);
         break;
     default:
         break;
@@ -315,28 +466,119 @@ static int decode_interrupt_cb(void *opaque)
     return ctx->abort_request.load();
 }
 
+static void update_low_water_mark(PlayerContext& ctx, BufferController::TrackType type, AVTrack& track){
+    const auto mark = ctx.buffering.lowWaterMark(type);
+    track.setLowWaterMark(mark.nb_packets, mark.duration, mark.bytes);
+}
+
 static bool demux_buffer_is_full(PlayerContext& ctx){
-    bool aq_full = false, vq_full = false;
-    int byte_size = 0;
+    /*A packet ring that ran out of slots can't accept anything, regardless of the other queues*/
+    if((ctx.atrack && ctx.atrack->queueFull()) || (ctx.vtrack && ctx.vtrack->queueFull())
+        || (ctx.strack && ctx.strack->queueFull()))
+        return true;
+
+    BufferController::QueueParams aq{}, vq{};
     if(ctx.atrack){
-        const auto [size, nb_pkts, dur] = ctx.atrack->getQueueParams();
-        byte_size += size;
-        aq_full = nb_pkts > MIN_FRAMES && (dur == 0.0 || dur > 1.0);
-    } else{aq_full = true;}
+        aq = ctx.atrack->getQueueParams();
+        update_low_water_mark(ctx, BufferController::TRACK_AUDIO, *ctx.atrack);
+    }
 
     if(ctx.vtrack && !ctx.vtrack->isAttachedPic()){
-        const auto [size, nb_pkts, dur] = ctx.vtrack->getQueueParams();
-        byte_size += size;
-        vq_full = nb_pkts > MIN_FRAMES && (dur == 0.0 || dur > 1.0);
-    } else{vq_full = true;}
+        vq = ctx.vtrack->getQueueParams();
+        update_low_water_mark(ctx, BufferController::TRACK_VIDEO, *ctx.vtrack);
+    }
+
+    return ctx.buffering.isFull(aq, vq);
+}
+
+static bool want_keyframe_index(PlayerContext& ctx, FormatContext& fmt_ctx, int st_idx){
+    const auto mode = ctx.core.options().keyframe_index;
+    if(mode == PlayerOptions::KF_INDEX_OFF || st_idx < 0 || fmt_ctx.isRealtime())
+        return false;
+    /*the file is read a second time, which is only cheap for local files*/
+    const char* proto = avio_find_protocol_name(ctx.url.c_str());
+    if(!proto || strcmp(proto, "file"))
+        return false;
+    return mode == PlayerOptions::KF_INDEX_ALWAYS || fmt_ctx.byteSeek() || !fmt_ctx.hasIndex(st_idx);
+}
 
-    return byte_size > MAX_QUEUE_SIZE || (aq_full && vq_full);
+/* the packet cache window and the keyframe index are aligned to the keyframes of the video stream,
+ * or of the audio stream if there's no video */
+static void update_cache_anchor(PlayerContext& ctx, FormatContext& fmt_ctx){
+    int anchor_idx = -1;
+    if(ctx.vtrack && !ctx.vtrack->isAttachedPic())
+        anchor_idx = fmt_ctx.videoStIdx();
+    else if(ctx.atrack)
+        anchor_idx = fmt_ctx.audioStIdx();
+    ctx.pkt_cache.setAnchorStream(anchor_idx);
+
+    if(ctx.kf_index && ctx.kf_index->streamIndex() == anchor_idx)
+        return;
+    ctx.kf_index = nullptr;
+    if(want_keyframe_index(ctx, fmt_ctx, anchor_idx))
+        ctx.kf_index = std::make_unique<KeyframeIndex>(ctx.url, anchor_idx, fmt_ctx.streamAt(anchor_idx).isAudio());
+}
+
+/* seeks exactly to the indexed keyframe at or before the target, if the index got that far */
+static bool seek_with_index(PlayerContext& ctx, FormatContext& fmt_ctx){
+    if(!ctx.kf_index)
+        return false;
+    const auto target = fmt_ctx.seekTargetTime();
+    const auto entry = ctx.kf_index->lookup(target);
+    if(!entry)
+        return false;
+    const int st_idx = (ctx.vtrack && !ctx.vtrack->isAttachedPic()) ? fmt_ctx.videoStIdx() : fmt_ctx.audioStIdx();
+    if(!fmt_ctx.seekToKeyframe(st_idx, entry->pts, entry->pos))
+        return false;
+    av_log(NULL, AV_LOG_VERBOSE, "Seek to %.3f served from the keyframe index, keyframe at %.3f(byte %" PRId64 ")\n",
+           target, entry->ts, entry->pos);
+    ++ctx.kf_index_hits;
+    return true;
+}
+
+/* while scrubbing, a seek whose target is closest to the keyframe already on screen is dropped */
+static bool scrub_hits_same_keyframe(PlayerContext& ctx, double target, double shown_kf_ts){
+    if(!ctx.kf_index || isnan(shown_kf_ts))
+        return false;
+    const auto entry = ctx.kf_index->lookup(target);
+    return entry && fabs(entry->ts - shown_kf_ts) < 1e-6;
+}
+
+/* returns true if the packet belongs to one of the open tracks */
+static bool queue_packet(PlayerContext& ctx, FormatContext& fmt_ctx, CAVPacket&& pkt){
+    const auto pkt_st_index = pkt.streamIndex();
+    if (ctx.atrack && pkt_st_index == fmt_ctx.audioStIdx()) {
+        ctx.buffering.observePacket(BufferController::TRACK_AUDIO, pkt);
+        ctx.atrack->putPacket(std::move(pkt));
+    } else if (ctx.vtrack && pkt_st_index == fmt_ctx.videoStIdx()
+               && !ctx.vtrack->isAttachedPic()) {
+        ctx.buffering.observePacket(BufferController::TRACK_VIDEO, pkt);
+        ctx.vtrack->putPacket(std::move(pkt));
+    } else if (ctx.strack && pkt_st_index == fmt_ctx.subStIdx()) {
+        ctx.strack->putPacket(std::move(pkt));
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static void queue_final_packets(PlayerContext& ctx, FormatContext& fmt_ctx){
+    if (ctx.vtrack)
+        ctx.vtrack->putFinalPacket(fmt_ctx.videoStIdx());
+    if (ctx.atrack)
+        ctx.atrack->putFinalPacket(fmt_ctx.audioStIdx());
+    if (ctx.strack)
+        ctx.strack->putFinalPacket(fmt_ctx.subStIdx());
 }
 
 /* this thread gets the stream from the disk or the network */
 void read_thread(PlayerContext& ctx)
 {
-    bool last_paused = false, wait_timeout = false;
+    bool last_paused = false, must_sleep = false;
+    /* while scrubbing, only the first video keyframe after each seek is queued */
+    bool scrubbing = false;
+    double scrub_kf_ts = NAN;
+    int scrub_seeks = 0, scrub_coalesced = 0;
     std::optional<FormatContext> ic;
     int subsequent_err_count = 0;
 
@@ -361,6 +603,7 @@ void read_thread(PlayerContext& ctx)
         stream_component_open(ctx, fmt_ctx.subStIdx(), fmt_ctx);
         ctx.streams_updated = true;
     }
+    update_cache_anchor(ctx, fmt_ctx);
 
     if (!ctx.atrack && !ctx.vtrack) {
         return;
@@ -409,24 +652,51 @@ void read_thread(PlayerContext& ctx)
                             //This shouldn't be happening
                             break;
                         }
+                        update_cache_anchor(ctx, fmt_ctx);
                     }
-                } else{
-                    if (fmt_ctx.seek(info, last_pts, pos)){
+                } else if (fmt_ctx.prepareSeek(info, last_pts, pos)){
+                    const bool scrub = info.scrub && ctx.vtrack && !ctx.vtrack->isAttachedPic();
+                    const bool coalesced = scrub && scrubbing
+                                           && scrub_hits_same_keyframe(ctx, fmt_ctx.seekTargetTime(), scrub_kf_ts);
+                    scrub_coalesced += coalesced;
+                    /* the final seek ends the scrubbing even if it fails, the audio would stay discarded otherwise */
+                    if (!scrub)
+                        scrubbing = false;
+                    /* seeks inside the cached window don't touch the container at all, the timestamps
+                     * can't be trusted for that if the format has discontinuities though.
+                     * The cache isn't filled while scrubbing, so it isn't used for that either */
+                    const bool from_cache = !scrub && ctx.pkt_cache.startReplay(fmt_ctx.byteSeek() ? NAN : fmt_ctx.seekTargetTime());
+                    const bool from_index = !coalesced && !from_cache && seek_with_index(ctx, fmt_ctx);
+                    const bool accurate = !scrub && (info.accurate || ctx.core.options().accurate_seek);
+                    if (!coalesced && (from_cache || from_index || fmt_ctx.executeSeek(accurate))){
+                        /* decode from the keyframe up to the target. The byte seeks without the index
+                         * land at an unknown time, so the target isn't reliable for them */
+                        const double preroll = (accurate && (from_index || !fmt_ctx.byteSeek()))
+                                               ? fmt_ctx.seekTargetTime() : NAN;
                         if(ctx.vtrack)
-                            ctx.vtrack->flush();
+                            ctx.vtrack->flush(preroll);
                         if(ctx.atrack)
-                            ctx.atrack->flush();
+                            ctx.atrack->flush(preroll);
                         if(ctx.strack)
                             ctx.strack->flush();
+                        ctx.extclk.resetTime();
+                        if(!from_cache)
+                            ctx.pkt_cache.clear();
+                        ctx.buffering.reset();
                         ctx.step = true;
+                        scrubbing = scrub;
+                        scrub_kf_ts = NAN;
+                        scrub_seeks += scrub;
                     }
                 }
             }
+        }
 
-            if (wait_timeout){
-                ctx.continue_read_thread.wait_for(lck, std::chrono::milliseconds(10));
-                wait_timeout = false;
-            }
+        if (must_sleep){
+            /* sleep until a queue runs low or a request arrives */
+            ctx.demux_wakeup.wait();
+            must_sleep = false;
+            continue;
         }
 
         if (ctx.paused != last_paused) {
@@ -435,9 +705,8 @@ void read_thread(PlayerContext& ctx)
         }
 
         if (last_paused && fmt_ctx.isRTSPorMMSH()) {
-            /* wait 10 ms to avoid trying to get another packet */
-            /* XXX: horrible */
-            wait_timeout = true;
+            /* don't try to get another packet until resumed */
+            must_sleep = true;
             continue;
         }
 
@@ -451,19 +720,42 @@ void read_thread(PlayerContext& ctx)
         }
 
         /* if the queue are full or eof was reached, no need to read more */
-        if ((!realtime && demux_buffer_is_full(ctx)) || fmt_ctx.eofReached()) {
-            wait_timeout = true;
+        const bool replaying = ctx.pkt_cache.isReplaying();
+        if (scrubbing) {
+            /* once the keyframe is queued, the next scrub or the final seek is awaited */
+            if (!isnan(scrub_kf_ts) || fmt_ctx.eofReached()) {
+                must_sleep = true;
+                continue;
+            }
+            CAVPacket pkt;
+            const int ret = fmt_ctx.read(pkt);
+            if (ret == AVERROR_EXIT)
+                break;
+            if (ret < 0 && ret != AVERROR_EOF && ++subsequent_err_count > 1000)
+                break;
+            if (ret >= 0)
+                subsequent_err_count = 0;
+            if (ret < 0 || !ctx.vtrack || pkt.streamIndex() != fmt_ctx.videoStIdx()
+                || !(pkt.constAv()->flags & AV_PKT_FLAG_KEY))
+                continue;
+            scrub_kf_ts = isnan(pkt.ts()) ? INFINITY : pkt.ts();
+            ctx.vtrack->putPacket(std::move(pkt));
+            /* drains the decoder, so the frame is output without waiting for more packets */
+            ctx.vtrack->putFinalPacket(fmt_ctx.videoStIdx());
+        } else if ((!realtime && demux_buffer_is_full(ctx)) || (!replaying && fmt_ctx.eofReached())) {
+            must_sleep = true;
+        } else if (replaying) {
+            CAVPacket pkt;
+            if (ctx.pkt_cache.replayNext(pkt))
+                queue_packet(ctx, fmt_ctx, std::move(pkt));
+            else if (fmt_ctx.eofReached())
+                queue_final_packets(ctx, fmt_ctx);
         } else {
             CAVPacket pkt;
             const int ret = fmt_ctx.read(pkt);
             if (ret < 0) {
                 if (ret == AVERROR_EOF) {
-                    if (ctx.vtrack)
-                        ctx.vtrack->putFinalPacket(fmt_ctx.videoStIdx());
-                    if (ctx.atrack)
-                        ctx.atrack->putFinalPacket(fmt_ctx.audioStIdx());
-                    if (ctx.strack)
-                        ctx.strack->putFinalPacket(fmt_ctx.subStIdx());
+                    queue_final_packets(ctx, fmt_ctx);
                 } else if (ret == AVERROR_EXIT) {
                     break;
                 }
@@ -472,65 +764,191 @@ void read_thread(PlayerContext& ctx)
                     break;
                 }
             } else{
-                const auto pkt_st_index = pkt.streamIndex();
-                if (ctx.atrack && pkt_st_index == fmt_ctx.audioStIdx()) {
-                    ctx.atrack->putPacket(std::move(pkt));
-                } else if (ctx.vtrack && pkt_st_index == fmt_ctx.videoStIdx()
-                           && !ctx.vtrack->isAttachedPic()) {
-                    ctx.vtrack->putPacket(std::move(pkt));
-                } else if (ctx.strack && pkt_st_index == fmt_ctx.subStIdx()) {
-                    ctx.strack->putPacket(std::move(pkt));
-                }
+                const CAVPacket cached_ref = pkt;
+                if (queue_packet(ctx, fmt_ctx, std::move(pkt)))
+                    ctx.pkt_cache.add(cached_ref);
                 subsequent_err_count = 0;
             }
         }
     }
 
+    /* the presentation thread may still be in its last iteration */
     std::scoped_lock lck(ctx.render_mutex);
+    const auto buf_stats = ctx.buffering.getStats();
+    ctx.core.log("Demuxer: woke up %d times, %d buffer refills, %d memory ceiling hits, %d seeks served from cache\n",
+                 ctx.demux_wakeup.wakeups(), buf_stats.refills, buf_stats.ceiling_hits, ctx.pkt_cache.hitCount());
+    if(ctx.vtrack)
+        ctx.core.log("Video: %d frames dropped late by the renderer, %d dropped early by the decoder\n",
+                     ctx.frame_drops_late, ctx.vtrack->earlyDrops());
+    if(ctx.frames_shown > 0)
+        ctx.core.log("Video: %d of %d pictures uploaded ahead, %.1f ms before their display on average, %.1f ms at least\n",
+                     ctx.frames_preloaded, ctx.frames_shown,
+                     ctx.frames_preloaded ? ctx.preload_slack_sum / ctx.frames_preloaded * 1000.0 : 0.0,
+                     ctx.frames_preloaded ? ctx.preload_slack_min * 1000.0 : 0.0);
+    if(ctx.vtrack && ctx.vtrack->qosStats().levelChanges() > 0){
+        const auto& qos = ctx.vtrack->qosStats();
+        ctx.core.log("Video QoS: %d level changes, degraded down to \"%s\", now at \"%s\"\n", qos.levelChanges(),
+                     QosController::levelName(qos.peakLevel()), QosController::levelName(qos.level()));
+    }
+    if(ctx.atrack)
+        ctx.core.log("Audio: %d underruns, %d more while the decoder was behind, output buffer at %.0f ms(%.0f ms at most), "
+                     "%.0f ms queued on average\n",
+                     ctx.aout.underrunCount(), ctx.aout.starvationCount(), ctx.aout.bufferDuration() * 1000.0,
+                     ctx.aout.peakBufferDuration() * 1000.0, ctx.aout.averageLatency() * 1000.0);
+    if(ctx.atrack){
+        const auto [correction, resets, speed] = ctx.atrack->clockStats();
+        ctx.core.log("Audio clock: %.2f ms corrections on average, %d resets, running at %.5fx\n",
+                     correction * 1000.0, resets, speed);
+    }
+    if(ctx.av_sync_frames > 0)
+        ctx.core.log("A/V sync: %.1f ms from the audio clock on average, %.1f ms at most, over %d pictures\n",
+                     ctx.av_sync_err_sum / ctx.av_sync_frames * 1000.0, ctx.av_sync_err_max * 1000.0, ctx.av_sync_frames);
+    if(scrub_seeks > 0)
+        ctx.core.log("Scrubbing: %d keyframe seeks, %d coalesced\n", scrub_seeks, scrub_coalesced);
+    if(ctx.kf_index){
+        ctx.core.log("Keyframe index: %d entries%s, %d seeks served from the index\n", ctx.kf_index->size(),
+                     ctx.kf_index->isFinished() ? "" : "(incomplete)", ctx.kf_index_hits);
+        ctx.kf_index = nullptr;
+    }
+
     stream_component_close(ctx, fmt_ctx.audioStIdx(), fmt_ctx);
     stream_component_close(ctx, fmt_ctx.videoStIdx(), fmt_ctx);
     stream_component_close(ctx, fmt_ctx.subStIdx(), fmt_ctx);
 }
 
+/* When the audio is a slave, the feeder stretches the frames by the difference to the master clock,
+ * once its average exceeds the buffering of the output */
+static void update_audio_sync(PlayerContext& ctx)
+{
+    double correction = 0.0;
+    if (get_master_sync_type(ctx) != PlayerOptions::SYNC_AUDIO) {
+        const double diff = ctx.atrack->getClockVal() - get_master_clock(ctx);
+        if (!isnan(diff) && fabs(diff) < AV_NOSYNC_THRESHOLD) {
+            ctx.audio_diff_cum = diff + AUDIO_DIFF_AVG_COEF * ctx.audio_diff_cum;
+            if (ctx.audio_diff_avg_count < AUDIO_DIFF_AVG_NB) {
+                /* not enough measures to have a correct estimate */
+                ctx.audio_diff_avg_count++;
+            } else if (fabs(ctx.audio_diff_cum * (1.0 - AUDIO_DIFF_AVG_COEF)) >= ctx.aout.bufferDuration()) {
+                correction = diff;
+            }
+        } else {
+            /* too big difference : may be initial PTS errors, so
+               reset A-V filter */
+            ctx.audio_diff_avg_count = 0;
+            ctx.audio_diff_cum = 0.0;
+        }
+    }
+    ctx.audio_sync_diff = correction;
+}
+
+/* The audio clock follows what the device got last. The clock runs by itself in between, so the
+ * same update is applied only once: after a pause it would be stale */
 static double refresh_audio(PlayerContext& ctx){
-    auto& aout = ctx.aout;
-    if(aout.maybeHandleChange()){
-        ctx.acvt.setOutputFmt(aout.rate(), [&aout]{CAVChannelLayout lout; lout.make_default(aout.channels()); return lout;}(),
-                               AV_SAMPLE_FMT_FLT);
+    if(ctx.atrack && !ctx.paused){
+        const auto played = ctx.aout.playedClock();
+        if(played.serial == ctx.atrack->serial() && played.time != ctx.audio_clock_time){
+            ctx.audio_clock_time = played.time;
+            ctx.atrack->updateClock(played.pts, played.time);
+            sync_external_clock(ctx, ctx.atrack->getClockVal());
+            update_audio_sync(ctx);
+        }
+        ctx.aout.adaptBuffer();
     }
 
-    double remaining_time = REFRESH_RATE;
+    return REFRESH_RATE;
+}
 
-    if(ctx.atrack && !ctx.paused && aout.isOpen()){
-        double buffered_time = aout.getLatency();
-        if(buffered_time > SDL_AUDIO_BUFLEN){
-            remaining_time = buffered_time / 4;
-        } else{
-            double decoded_dur = 0.0;
-            do{
-                const CAVFrame *af = ctx.atrack->getFrame();
-                if(!af){
-                    break;
-                }
+/* The samples the frame is stretched to, to make up for diff seconds of the audio clock ahead of the master */
+static int wanted_nb_samples(AVFrameView aframe, double diff)
+{
+    const int nb_samples = aframe.nbSamples();
+    if (diff == 0.0)
+        return nb_samples;
+    const int min_nb_samples = nb_samples * (100 - SAMPLE_CORRECTION_PERCENT_MAX) / 100;
+    const int max_nb_samples = nb_samples * (100 + SAMPLE_CORRECTION_PERCENT_MAX) / 100;
+    return std::clamp(nb_samples + int(diff * aframe.sampleRate()), min_nb_samples, max_nb_samples);
+}
 
-                auto& dst = ctx.audio_buf;
-                AVFrameView aframe(*af->constAv());
-                const auto wanted_nb_samples = aframe.nbSamples();
+/* Writes the frame to the ring of the audio output: interleaved straight into the ring when it is
+ * already in the output format, or the converted samples in audio_buf(converted bytes) otherwise */
+static bool write_audio_frame(PlayerContext& ctx, const CAVFrame& af, int converted)
+{
+    if (converted < 0) {
+        AVFrameView aframe(*af.constAv());
+        return ctx.aout.writeWith(AudioResampler::passthroughSize(aframe), af.ts(), af.serial(),
+                                  [&aframe](uint8_t* dst, size_t offset, size_t len){
+                                      AudioResampler::interleave(aframe, offset, len, dst);});
+    }
+    return ctx.aout.write(ctx.audio_buf.data(), converted, af.ts(), af.serial());
+}
 
-                if(ctx.acvt.convert(aframe, ctx.audio_buf, wanted_nb_samples, false)){}
+/* Keeps the ring of the audio output filled with the decoded frames converted to its format. The
+ * device pulls the samples from its own callback, so the audio doesn't wait for the presentation */
+static void audio_thread(PlayerContext& ctx)
+{
+    int written_serial = -1;
+    const AudioTrack* fed_track = nullptr;
+    /*a frame waiting for room in the ring, after flushes that the callback didn't skip yet(paused).
+     * It stays valid until the next getFrame() of its track*/
+    const CAVFrame* pending = nullptr;
+    int pending_converted = -1;
+    int frames_passed = 0, frames_resampled = 0, frames_stretched = 0;
+    while (!ctx.abort_request.load()) {
+        {
+            std::scoped_lock lck(ctx.audio_mutex);
+            auto& aout = ctx.aout;
+            if (aout.maybeHandleChange()) {
+                ctx.acvt.setOutputFmt(aout.rate(), [&aout]{CAVChannelLayout lout; lout.make_default(aout.channels()); return lout;}(),
+                                      AV_SAMPLE_FMT_FLT);
+                written_serial = -1;
+            }
+            if (ctx.atrack.get() != fed_track) {
+                fed_track = ctx.atrack.get();
+                pending = nullptr;
+            }
 
-                decoded_dur += (double)ctx.audio_buf.size() / aout.bitrate();
-                aout.sendData(ctx.audio_buf.data(), ctx.audio_buf.size(), false);
-                ctx.audio_buf.clear();
-                if(!std::isnan(af->ts())){
-                    buffered_time = aout.getLatency();
-                    ctx.atrack->updateClock(af->ts() + af->dur() - buffered_time);
+            if (ctx.atrack && aout.isOpen()) {
+                /*the samples of the previous serial that weren't played are dropped on a seek*/
+                if (ctx.atrack->serial() != written_serial) {
+                    aout.flushBuffers();
+                    written_serial = ctx.atrack->serial();
+                    pending = nullptr;
                 }
-            }while(decoded_dur < SDL_AUDIO_BUFLEN);
+                if (pending && write_audio_frame(ctx, *pending, pending_converted))
+                    pending = nullptr;
+                bool dry = false;
+                while (!pending && aout.wantsData()) {
+                    const CAVFrame *af = ctx.atrack->getFrame();
+                    if ((dry = !af))
+                        break;
+                    if (af->serial() != written_serial) {
+                        aout.flushBuffers();
+                        written_serial = af->serial();
+                    }
+
+                    AVFrameView aframe(*af->constAv());
+                    /*the stretched frames always go through the resampler*/
+                    const int wanted = wanted_nb_samples(aframe, ctx.audio_sync_diff.load());
+                    int converted = -1;
+                    if (wanted == aframe.nbSamples() && ctx.acvt.isPassthrough(aframe))
+                        frames_passed++;
+                    else if ((converted = ctx.acvt.convert(aframe, ctx.audio_buf, wanted, false)) > 0)
+                        (wanted == aframe.nbSamples() ? frames_resampled : frames_stretched)++;
+                    else
+                        continue;
+                    if (!write_audio_frame(ctx, *af, converted)) {
+                        pending = af;
+                        pending_converted = converted;
+                    }
+                }
+                aout.setSourceReady(!dry);
+            }
         }
+        ctx.aout.waitForRoom(AUDIO_FEED_INTERVAL);
     }
-
-    return remaining_time;
+    if (frames_passed + frames_resampled + frames_stretched > 0)
+        ctx.core.log("Audio: %d frames interleaved into the output ring, %d resampled, %d stretched to follow the master clock\n",
+                     frames_passed, frames_resampled, frames_stretched);
 }
 
 static double refresh_video(PlayerContext& ctx){
@@ -568,18 +986,63 @@ static double playback_loop(PlayerContext& ctx){
     return std::min(audio_remaining_time, video_remaining_time);
 }
 
+/* Owns the renderer and the timing of the frames while the file plays: it sleeps until the next
+ * deadline, or until it's woken by the GUI(pause, window redraws) or by a seek. The GUI only gets
+ * the position and the streams, posted to its event loop */
+static void render_thread(PlayerContext& ctx)
+{
+    double last_gui_update = 0.0;
+    while (!ctx.abort_request.load()) {
+        double remaining_time;
+        {
+            std::scoped_lock lck(ctx.render_mutex);
+            if (ctx.pause_toggle_req.exchange(0) & 1) {
+                stream_toggle_pause(ctx);
+                ctx.demux_wakeup.signal();
+            }
+            remaining_time = playback_loop(ctx);
+            ctx.sdl_renderer.handlePendingRedraw();
+
+            if (ctx.streams_updated) {
+                ctx.streams_updated = false;
+                ctx.core.postStreams(ctx.streams);
+            }
+            const double time = gettime();
+            if (time - last_gui_update >= GUI_UPDATE_INTERVAL) {
+                last_gui_update = time;
+                const auto pos = get_master_clock(ctx);
+                if (!isnan(pos))
+                    ctx.core.postPosition(pos, ctx.stream_duration);
+            }
+        }
+        ctx.render_wakeup.waitFor(remaining_time);
+    }
+    ctx.sdl_renderer.releaseContext();
+}
+
 void PlayerCore::openURL(QUrl url){
     if(player_ctx){
         stopPlayback();
     }
 
     if((player_ctx = std::make_unique<PlayerContext>(url.toString().toStdString(), std::ref(*video_renderer), std::ref(*this)))){
-        refreshPlayback(); //To start the refresh timer
+        if(opts.thumbnails){
+            thumbnailer = std::make_unique<Thumbnailer>(player_ctx->url, opts, [this](QImage img, double pos){
+                emit thumbnailReady(img, pos);});
+        }
         emit setControlsActive(true);
     }
 }
 
 void PlayerCore::stopPlayback(){
+    if(thumbnailer){
+        const auto st = thumbnailer->getStats();
+        if(st.requests > 0){
+            log("Thumbnails: %d requests, %.1f%% cache hits, %d decoded, latency avg %.1f ms, max %.1f ms\n",
+                st.requests, 100.0 * st.hits / st.requests, st.decoded, st.avg_latency * 1000.0, st.max_latency * 1000.0);
+        }
+        thumbnailer = nullptr;
+    }
     if(player_ctx){
         player_ctx = nullptr;
         emit setControlsActive(false);
@@ -589,8 +1052,8 @@ void PlayerCore::stopPlayback(){
 
 void PlayerCore::togglePause(){
     if(player_ctx){
-        std::scoped_lock lck(player_ctx->render_mutex);
-        stream_toggle_pause(*player_ctx);
+        player_ctx->pause_toggle_req.fetch_add(1);
+        player_ctx->render_wakeup.signal();
     }
 }
 
@@ -599,14 +1062,39 @@ void PlayerCore::requestSeekPercent(double percent){
         std::scoped_lock slck(player_ctx->demux_mutex);
         player_ctx->seek_info = {.type = SeekInfo::SEEK_PERCENT, .percent = percent};
         player_ctx->seek_req = true;
+        player_ctx->demux_wakeup.signal();
     }
 }
 
+void PlayerCore::requestScrub(double percent){
+    if(player_ctx){
+        std::scoped_lock slck(player_ctx->demux_mutex);
+        player_ctx->seek_info = {.type = SeekInfo::SEEK_PERCENT, .percent = percent, .scrub = true};
+        player_ctx->seek_req = true;
+        player_ctx->demux_wakeup.signal();
+    }
+}
+
+void PlayerCore::endScrub(double percent){
+    if(player_ctx){
+        std::scoped_lock slck(player_ctx->demux_mutex);
+        player_ctx->seek_info = {.type = SeekInfo::SEEK_PERCENT, .percent = percent, .accurate = true};
+        player_ctx->seek_req = true;
+        player_ctx->demux_wakeup.signal();
+    }
+}
+
+void PlayerCore::requestThumbnail(double percent){
+    if(thumbnailer)
+        thumbnailer->request(percent);
+}
+
 void PlayerCore::requestSeekIncr(double incr){
     if(player_ctx){
         std::scoped_lock slck(player_ctx->demux_mutex);
         player_ctx->seek_info = {.type = SeekInfo::SEEK_INCREMENT, .increment = incr};
         player_ctx->seek_req = true;
+        player_ctx->demux_wakeup.signal();
     }
 }
 
@@ -618,44 +1106,21 @@ void PlayerCore::log(const char* fmt, ...){
     QMetaObject::invokeMethod(loggerW, &LoggerWidget::logMessage, msg);
 }
 
-PlayerCore::PlayerCore(QObject* parent, VideoDisplayWidget* dw, LoggerWidget* lw): QObject(parent), video_dw(dw), loggerW(lw), refresh_timer(this){
+PlayerCore::PlayerCore(QObject* parent, VideoDisplayWidget* dw, LoggerWidget* lw): QObject(parent), video_dw(dw), loggerW(lw),
+    opts(PlayerOptions::load(Utils::getApplicationDir() + "/settings/player.settings")){
     video_renderer = dw->getSDLRenderer();
-
-    connect(&refresh_timer, &QTimer::timeout, this, &PlayerCore::refreshPlayback);
 }
 
 PlayerCore::~PlayerCore(){
     stopPlayback();
 }
 
-void PlayerCore::refreshPlayback(){
-    if(player_ctx){
-        std::scoped_lock lck(player_ctx->render_mutex);
-        const auto remaining_time = playback_loop(*player_ctx) * 1000;
-        refresh_timer.setInterval(static_cast<int>(remaining_time));
-        if(!refresh_timer.isActive()){
-            refresh_timer.setTimerType(Qt::PreciseTimer);
-            refresh_timer.start();
-        }
-        updateGUI();
-    } else{
-        refresh_timer.stop();
-    }
-}
-
-void PlayerCore::handleStreamsUpdate(){
-    if(player_ctx->streams_updated){
-        player_ctx->streams_updated = false;
-        emit sigUpdateStreams(player_ctx->streams);
-    }
+void PlayerCore::postPosition(double pos, double dur){
+    QMetaObject::invokeMethod(this, [this, pos, dur]{emit updatePlaybackPos(pos, dur);});
 }
 
-void PlayerCore::updateGUI(){
-    handleStreamsUpdate();
-    const auto pos = get_master_clock(*player_ctx);
-    if(!std::isnan(pos)){
-        emit updatePlaybackPos(pos, player_ctx->stream_duration);
-    }
+void PlayerCore::postStreams(std::vector<CAVStream> streams){
+    QMetaObject::invokeMethod(this, [this, streams = std::move(streams)]{emit sigUpdateStreams(streams);});
 }
 
 void PlayerCore::streamSwitch(int idx){
@@ -663,9 +1128,14 @@ void PlayerCore::streamSwitch(int idx){
         std::scoped_lock lck(player_ctx->demux_mutex);
         player_ctx->seek_info = SeekInfo{.type = SeekInfo::SEEK_STREAM_SWITCH, .stream_idx = idx};
         player_ctx->seek_req = true;
+        player_ctx->demux_wakeup.signal();
     }
 }
 
+const PlayerOptions& PlayerCore::options() const{
+    return opts;
+}
+
 void PlayerCore::updateTitle(std::string title){
     emit setPlayerTitle(QString::fromStdString(title));
 }
@@ -5,9 +5,10 @@
 #include "../src/GUI/LoggerWidget.h"
 
 #include "cavstream.hpp"
+#include "playeroptions.hpp"
 
 #include <QUrl>
-#include <QTimer>
+#include <QImage>
 
 class PlayerCore final : public QObject
 {
@@ -21,13 +22,10 @@ private:
     LoggerWidget* loggerW = nullptr;
     SDLRenderer* video_renderer = nullptr;
     std::unique_ptr<struct PlayerContext> player_ctx;
+    std::unique_ptr<class Thumbnailer> thumbnailer;
     float audio_vol = 1.0f;
     double stream_duration = 0.0, cur_pos = 0.0;
-    QTimer refresh_timer;
-
-private:
-    void handleStreamsUpdate();
-    void updateGUI();
+    const PlayerOptions opts;
 
 signals:
     void sigUpdateStreams(std::vector<CAVStream> streams);
@@ -35,20 +33,30 @@ signals:
     void setControlsActive(bool active);
     void resetGUI();
     void setPlayerTitle(QString title);
+    /*pos is relative to the start of the file*/
+    void thumbnailReady(QImage img, double pos);
 
 public:
    PlayerCore(QObject* parent, VideoDisplayWidget* video_dw, LoggerWidget* logW);
    void log(const char* fmt, ...);
 
    void updateTitle(std::string title);
+   /*From the presentation thread, the signals are emitted on the GUI thread*/
+   void postPosition(double pos, double dur);
+   void postStreams(std::vector<CAVStream> streams);
+   const PlayerOptions& options() const;
 
    public slots:
         void openURL(QUrl url);
         void stopPlayback();
         void togglePause();
         void requestSeekPercent(double percent);
+        /*While the slider is dragged: the seeks are coalesced and only the keyframes are shown*/
+        void requestScrub(double percent);
+        /*The slider was released, seeks exactly to the final position*/
+        void endScrub(double percent);
+        void requestThumbnail(double percent);
         void requestSeekIncr(double incr);
-        void refreshPlayback();
         void streamSwitch(int idx);
 };
 
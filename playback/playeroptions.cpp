@@ -0,0 +1,63 @@
+#include "playeroptions.hpp"
+
+#include <QSettings>
+
+#include <type_traits>
+
+PlayerOptions PlayerOptions::load(const QString& path){
+    PlayerOptions opts;
+    QSettings sets(path, QSettings::IniFormat);
+
+    auto read = [&sets](const QString& key, auto& val){
+        using T = std::decay_t<decltype(val)>;
+        if(sets.contains(key)){
+            val = sets.value(key, val).template value<T>();
+        } else{
+            sets.setValue(key, val);
+        }
+    };
+
+    sets.beginGroup("buffering");
+    read("video_low_s", opts.video_buffer_low);
+    read("video_high_s", opts.video_buffer_high);
+    read("audio_low_s", opts.audio_buffer_low);
+    read("audio_high_s", opts.audio_buffer_high);
+    read("min_packets", opts.buffer_min_packets);
+    read("max_mb", opts.buffer_max_mb);
+    read("seek_cache_mb", opts.seek_cache_mb);
+    sets.endGroup();
+
+    sets.beginGroup("seeking");
+    read("keyframe_index", opts.keyframe_index);
+    read("accurate", opts.accurate_seek);
+    sets.endGroup();
+
+    sets.beginGroup("thumbnails");
+    read("enabled", opts.thumbnails);
+    read("width", opts.thumbnail_width);
+    read("bucket_s", opts.thumbnail_bucket_s);
+    read("cache_size", opts.thumbnail_cache_size);
+    sets.endGroup();
+
+    sets.beginGroup("decoding");
+    read("threads_budget", opts.decoder_threads_budget);
+    read("thread_mode", opts.decoder_thread_mode);
+    read("thread_overrides", opts.decoder_thread_overrides);
+    read("qos", opts.qos);
+    read("qos_max_level", opts.qos_max_level);
+    read("early_frame_drop", opts.early_frame_drop);
+    read("display_downscale", opts.display_downscale);
+    sets.endGroup();
+
+    sets.beginGroup("audio");
+    read("output_buffer_ms", opts.audio_output_buffer_ms);
+    read("output_buffer_min_ms", opts.audio_output_buffer_min_ms);
+    read("output_buffer_max_ms", opts.audio_output_buffer_max_ms);
+    sets.endGroup();
+
+    sets.beginGroup("sync");
+    read("master", opts.sync_master);
+    sets.endGroup();
+
+    return opts;
+}
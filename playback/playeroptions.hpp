@@ -0,0 +1,65 @@
+#ifndef PLAYEROPTIONS_HPP
+#define PLAYEROPTIONS_HPP
+
+#include <QString>
+
+/* Tunables of the playback engine. They are read from the settings file when the player
+ * is created, and the missing keys are written back with their defaults, so the file
+ * always lists every available option. */
+struct PlayerOptions final {
+    /*Buffering, in seconds of data queued per track*/
+    double video_buffer_low = 3.0, video_buffer_high = 6.0;
+    double audio_buffer_low = 1.5, audio_buffer_high = 3.0;
+    /*Used for the tracks with no duration or bitrate information*/
+    int buffer_min_packets = 25;
+    /*Upper limit for the size of all packet queues combined*/
+    int buffer_max_mb = 256;
+    /*Size of the window of already demuxed packets that seeks can be served from, 0 to disable*/
+    int seek_cache_mb = 128;
+
+    enum KeyframeIndexMode{KF_INDEX_OFF, KF_INDEX_AUTO, KF_INDEX_ALWAYS};
+    /*Background keyframe indexing of local files. In the auto mode only the files that
+     * the demuxer can't seek in precisely(no index, or seeking by bytes) are indexed*/
+    int keyframe_index = KF_INDEX_AUTO;
+    /*Seek to the exact target instead of the keyframe before it, decoding and dropping the frames in between*/
+    bool accurate_seek = false;
+
+    /*Previews shown when hovering the playback slider*/
+    bool thumbnails = true;
+    int thumbnail_width = 160;
+    /*The previews are cached per bucket of this many seconds*/
+    double thumbnail_bucket_s = 2.0;
+    int thumbnail_cache_size = 200;
+
+    /*Threads shared by all the decoders of the process, 0 for the number of cores*/
+    int decoder_threads_budget = 0;
+    /*auto(slice threading for live sources, frame threading otherwise), frame or slice*/
+    QString decoder_thread_mode = "auto";
+    /*Per codec overrides: codec=threads[:frame|slice],... e.g. "h264=4:frame,hevc=8"*/
+    QString decoder_thread_overrides;
+
+    /*Degrade the video decoding when the machine can't keep up, up to qos_max_level(1-4, see QosController)*/
+    bool qos = true;
+    int qos_max_level = 4;
+    /*Drop the video frames that can't be shown in time right after decoding, before the filters*/
+    bool early_frame_drop = true;
+    /*Scale the video down to the size it is displayed at before the upload, and use the reduced
+     * resolution decoding of the codecs that support it when the video is larger than the screen*/
+    bool display_downscale = true;
+
+    /*Audio converted ahead for the device, in milliseconds. Lower is more responsive, but needs the
+     * feeder thread to be scheduled more reliably. It starts at audio_output_buffer_ms, grows on the
+     * underruns and shrinks back while the device never gets close to one, within the min and max*/
+    int audio_output_buffer_ms = 60;
+    int audio_output_buffer_min_ms = 20, audio_output_buffer_max_ms = 500;
+
+    enum SyncMaster{SYNC_AUDIO, SYNC_VIDEO, SYNC_EXTERNAL};
+    /*The clock the others follow. The video follows it by dropping or repeating pictures, the audio by
+     * stretching its frames slightly. Without the track the audio master falls back to the video, and
+     * the video master to the audio*/
+    int sync_master = SYNC_AUDIO;
+
+    static PlayerOptions load(const QString& path);
+};
+
+#endif // PLAYEROPTIONS_HPP
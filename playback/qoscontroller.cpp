@@ -0,0 +1,104 @@
+#include "qoscontroller.hpp"
+
+#include <algorithm>
+
+extern "C"{
+#include <libavutil/log.h>
+}
+
+/* length of a measurement window, in seconds of video */
+#define QOS_WINDOW 1.0
+/* more late drops than this share of the frames means overload */
+#define QOS_MAX_LATE_DROP_RATIO 0.02
+/* above this share of the frame duration spent decoding, the decoder can't absorb any more work */
+#define QOS_BUSY_HIGH 0.9
+#define QOS_BUSY_LOW 0.5
+/* windows with headroom needed before going one level back up */
+#define QOS_CALM_WINDOWS 4
+/* windows to wait after a change before judging its effect */
+#define QOS_HOLD_WINDOWS 2
+
+QosController::QosController(bool en, int max_lvl) : enabled(en), max_level(std::clamp(max_lvl, 0, QOS_LEVEL_COUNT - 1)) {
+    start_window();
+}
+
+void QosController::start_window(){
+    frames = queued_sum = 0;
+    busy = media = 0.0;
+    late_drops_start = late_drops.load();
+}
+
+void QosController::reportLateDrop(){
+    ++late_drops;
+}
+
+void QosController::resetWindow(){
+    start_window();
+    hold_windows = QOS_HOLD_WINDOWS;
+}
+
+bool QosController::update(double frame_busy, double dur, int queued, int capacity){
+    if(!enabled)
+        return false;
+
+    ++frames;
+    busy += frame_busy;
+    media += dur > 0.0 ? dur : 0.04;
+    queued_sum += queued;
+    if(media < QOS_WINDOW)
+        return false;
+
+    const int window_frames = frames;
+    const int drops = late_drops.load() - late_drops_start;
+    const double load = busy / media;
+    const double avg_queued = double(queued_sum) / window_frames;
+    start_window();
+
+    if(hold_windows > 0){
+        --hold_windows;
+        return false;
+    }
+
+    const int lvl = cur_level.load();
+    int new_lvl = lvl;
+    const bool overloaded = drops > window_frames * QOS_MAX_LATE_DROP_RATIO
+                            || (load > QOS_BUSY_HIGH && avg_queued < 1.0);
+    const bool headroom = drops == 0 && load < QOS_BUSY_LOW && avg_queued >= capacity / 2.0;
+    if(overloaded){
+        calm_windows = 0;
+        new_lvl = std::min(lvl + 1, max_level);
+    } else if(headroom && lvl > QOS_NONE){
+        if(++calm_windows >= QOS_CALM_WINDOWS){
+            calm_windows = 0;
+            new_lvl = lvl - 1;
+        }
+    } else{
+        calm_windows = 0;
+    }
+
+    if(new_lvl == lvl)
+        return false;
+
+    av_log(NULL, AV_LOG_INFO, "Video QoS: %s -> %s(%d late drops, load %.2f, %.1f frames queued)\n",
+           levelName(Level(lvl)), levelName(Level(new_lvl)), drops, load, avg_queued);
+    cur_level = new_lvl;
+    peak = std::max(peak.load(), new_lvl);
+    ++changes;
+    hold_windows = QOS_HOLD_WINDOWS;
+    return true;
+}
+
+QosController::Level QosController::level() const{return Level(cur_level.load());}
+int QosController::levelChanges() const{return changes.load();}
+QosController::Level QosController::peakLevel() const{return Level(peak.load());}
+
+const char* QosController::levelName(Level lvl){
+    switch(lvl){
+    case QOS_NONE: return "full quality";
+    case QOS_SKIP_LOOP_FILTER_NONREF: return "no non-ref deblocking";
+    case QOS_SKIP_LOOP_FILTER: return "no deblocking";
+    case QOS_SKIP_NONREF: return "non-ref frames skipped";
+    case QOS_HALF_SIZE: return "half size";
+    default: return "unknown";
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef QOSCONTROLLER_HPP
+#define QOSCONTROLLER_HPP
+
+#include <atomic>
+
+#include <QtGlobal>
+
+/* Degrades the video decoding step by step when the machine can't keep up, and restores it
+ * once there is headroom again. The load is judged over windows of about a second from the
+ * frames dropped late by the renderer, the time the decoder thread spends on each frame compared
+ * to its duration and the number of frames waiting for display. */
+class QosController final
+{
+    Q_DISABLE_COPY_MOVE(QosController);
+public:
+    enum Level{
+        QOS_NONE,
+        QOS_SKIP_LOOP_FILTER_NONREF, /*no deblocking of the non-reference frames*/
+        QOS_SKIP_LOOP_FILTER, /*no deblocking at all, fast decoding flags*/
+        QOS_SKIP_NONREF, /*the non-reference frames aren't decoded*/
+        QOS_HALF_SIZE, /*the frames are scaled down to half size before the rest of the filters and the upload*/
+        QOS_LEVEL_COUNT
+    };
+
+private:
+    const bool enabled;
+    const int max_level;
+    std::atomic<int> late_drops = 0;
+    std::atomic<int> cur_level = QOS_NONE;
+
+    /*the current window, decoder thread only*/
+    int frames = 0, queued_sum = 0, late_drops_start = 0;
+    double busy = 0.0, media = 0.0;
+    int calm_windows = 0, hold_windows = 0;
+    std::atomic<int> changes = 0, peak = QOS_NONE;
+
+    void start_window();
+
+public:
+    QosController(bool enabled, int max_level);
+
+    /*Called by the renderer for every frame dropped because it was late*/
+    void reportLateDrop();
+    /*Decoder thread. busy: time spent decoding and filtering the frame, dur: its duration,
+     * queued/capacity: frames waiting for display. Returns true if the level changed*/
+    bool update(double busy, double dur, int queued, int capacity);
+    /*The drops around seeks and stream changes don't say anything about the load*/
+    void resetWindow();
+
+    Level level() const;
+    int levelChanges() const;
+    Level peakLevel() const;
+    static const char* levelName(Level lvl);
+};
+
+#endif // QOSCONTROLLER_HPP
@@ -1,11 +1,22 @@
 #include "sdlrenderer.hpp"
 #include "sdlkeymap.hpp"
+#include "clock.hpp"
 
 #include <QWindow>
 #include <QKeyEvent>
 #include <QApplication>
 #include <QTimer>
 #include <stdexcept>
+#include <algorithm>
+#include <cstring>
+
+extern "C"{
+#include <libavutil/imgutils.h>
+}
+
+/* the uploads are copied by this many threads at most, in slices of at least this many rows */
+#define UPLOAD_MAX_THREADS 4
+#define UPLOAD_MIN_SLICE_ROWS 256
 
 static constexpr struct TextureFormatEntry {
     AVPixelFormat format;
@@ -35,9 +46,59 @@ static constexpr struct TextureFormatEntry {
     { AV_PIX_FMT_P010,           SDL_PIXELFORMAT_P010 }
 };
 
+/* The YUV matrices that are tried on the renderer, the frames using the others are converted by swscale */
+static constexpr AVColorSpace sdl_candidate_color_spaces[] = {
+    AVCOL_SPC_BT709,
+    AVCOL_SPC_BT470BG,
+    AVCOL_SPC_SMPTE170M,
+    AVCOL_SPC_BT2020_NCL,
+    AVCOL_SPC_SMPTE240M,
+};
+
+/* The SDL colorspace describing the frame. SDL uses the same(H.273) codes as FFmpeg for the
+ * primaries, transfer characteristics and matrices. The properties left unspecified get the
+ * usual values for the resolution, VideoTrack tags the video frames from their unscaled size already */
+static SDL_Colorspace get_sdl_colorspace(AVFrameView frame)
+{
+    if (frame.isRGB())
+        return SDL_COLORSPACE_SRGB;
+
+    const bool hd = frame.height() >= 720;
+    const auto range = frame.colorRange() == AVCOL_RANGE_JPEG ? SDL_COLOR_RANGE_FULL : SDL_COLOR_RANGE_LIMITED;
+    const auto matrix = frame.colorSpace() != AVCOL_SPC_UNSPECIFIED ? frame.colorSpace()
+                        : hd ? AVCOL_SPC_BT709 : AVCOL_SPC_SMPTE170M;
+    const auto primaries = frame.colorPrim() != AVCOL_PRI_UNSPECIFIED ? frame.colorPrim()
+                           : hd ? AVCOL_PRI_BT709 : AVCOL_PRI_SMPTE170M;
+    const auto transfer = frame.avcolTRC() != AVCOL_TRC_UNSPECIFIED ? frame.avcolTRC() : AVCOL_TRC_BT709;
+
+    auto chroma = SDL_CHROMA_LOCATION_LEFT;
+    switch (frame.chromaLoc()) {
+    case AVCHROMA_LOC_CENTER:  chroma = SDL_CHROMA_LOCATION_CENTER; break;
+    case AVCHROMA_LOC_TOPLEFT: chroma = SDL_CHROMA_LOCATION_TOPLEFT; break;
+    default: break;
+    }
+
+    return SDL_DEFINE_COLORSPACE(SDL_COLOR_TYPE_YCBCR, range, SDL_ColorPrimaries(primaries),
+                                 SDL_TransferCharacteristics(transfer), SDL_MatrixCoefficients(matrix), chroma);
+}
+
+static SDL_Texture* create_texture(SDL_Renderer* renderer, SDL_PixelFormat format, SDL_Colorspace colorspace, int w, int h)
+{
+    const auto props = SDL_CreateProperties();
+    SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_FORMAT_NUMBER, format);
+    SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_COLORSPACE_NUMBER, colorspace);
+    SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_ACCESS_NUMBER, SDL_TEXTUREACCESS_STREAMING);
+    SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_WIDTH_NUMBER, w);
+    SDL_SetNumberProperty(props, SDL_PROP_TEXTURE_CREATE_HEIGHT_NUMBER, h);
+    const auto tex = SDL_CreateTextureWithProperties(renderer, props);
+    SDL_DestroyProperties(props);
+    return tex;
+}
+
 static bool realloc_texture(SDL_Renderer* renderer, SDL_Texture **texture, SDL_PixelFormat new_format,
                            int new_width, int new_height, SDL_BlendMode blendmode, AVFrameView frame)
 {
+    const auto new_colorspace = get_sdl_colorspace(frame);
     SDL_PixelFormat format;
     SDL_Colorspace colorspace;
     int access, w, h;
@@ -52,7 +113,7 @@ static bool realloc_texture(SDL_Renderer* renderer, SDL_Texture **texture, SDL_P
         auto integer_colorspace = SDL_GetNumberProperty(props, SDL_PROP_TEXTURE_COLORSPACE_NUMBER, SDL_COLORSPACE_UNKNOWN);
         format = static_cast<SDL_PixelFormat>(integer_format);
         colorspace = static_cast<SDL_Colorspace>(integer_colorspace);
-        return new_width != w || new_height != h || new_format != format;
+        return new_width != w || new_height != h || new_format != format || new_colorspace != colorspace;
     };
 
     if (must_realloc_texture(*texture)) {
@@ -60,9 +121,16 @@ static bool realloc_texture(SDL_Renderer* renderer, SDL_Texture **texture, SDL_P
         int pitch;
         if (*texture)
             SDL_DestroyTexture(*texture);
-        //const auto texprops = SDL_CreateProperties();
-        if (!(*texture = SDL_CreateTexture(renderer, new_format, SDL_TEXTUREACCESS_STREAMING, new_width, new_height)))
-            return false;
+        /* the transfer characteristics(HDR) may not be supported, the matrix was checked by probeColorSpaces */
+        if (!(*texture = create_texture(renderer, new_format, new_colorspace, new_width, new_height))) {
+            av_log(NULL, AV_LOG_VERBOSE, "Texture with the colorspace 0x%x failed(%s), using the defaults of the matrix\n",
+                   unsigned(new_colorspace), SDL_GetError());
+            const auto fallback = SDL_DEFINE_COLORSPACE(SDL_COLORSPACETYPE(new_colorspace), SDL_COLORSPACERANGE(new_colorspace),
+                                                        SDL_COLOR_PRIMARIES_BT709, SDL_TRANSFER_CHARACTERISTICS_BT709,
+                                                        SDL_COLORSPACEMATRIX(new_colorspace), SDL_COLORSPACECHROMA(new_colorspace));
+            if (!(*texture = create_texture(renderer, new_format, fallback, new_width, new_height)))
+                return false;
+        }
         if (!SDL_SetTextureBlendMode(*texture, blendmode))
             return false;
     }
@@ -135,7 +203,7 @@ static uintptr_t getSDLWindowHandle(SDL_Window* sdl_wnd){
     return retrieved_handle;
 }
 
-SDLRenderer::SDLRenderer(QObject* parent) : QObject(parent), event_timer(this) {
+SDLRenderer::SDLRenderer(QObject* parent) : QObject(parent), upload_workers(UPLOAD_MAX_THREADS), event_timer(this) {
     auto cleanup = [this]{
         if(renderer)
             SDL_DestroyRenderer(renderer);
@@ -170,8 +238,10 @@ SDLRenderer::SDLRenderer(QObject* parent) : QObject(parent), event_timer(this) {
             tex_fmt = tex_fmts[i];
         }
     }
+    probeColorSpaces();
     SDL_ShowWindow(wnd);
     SDL_SyncWindow(wnd);
+    updateOutputSize();
 
     event_timer.setInterval(30);
     event_timer.setTimerType(Qt::CoarseTimer);
@@ -226,32 +296,123 @@ void SDLRenderer::processSDLEvent(const SDL_Event& evt){
         if(evt.type == SDL_EVENT_WINDOW_RESIZED){
             window_width = evt.window.data1;
             window_height = evt.window.data2;
-            qDebug() << "Window wxh: " << window_width << "x" <<window_height;
+            qDebug() << "Window wxh: " << evt.window.data1 << "x" << evt.window.data2;
+            updateOutputSize();
         }
-        refreshDisplay();
+        if(!request_redraw())
+            refreshDisplay();
         break;
     }
 }
 
+/* From the GUI thread: the renderer belongs to the presentation thread, so the output size is that of
+ * the window(what the renderer draws to, there is no render target or logical size) */
+void SDLRenderer::updateOutputSize(){
+    int w = 0, h = 0;
+    if(SDL_GetWindowSizeInPixels(wnd, &w, &h)){
+        output_width = w;
+        output_height = h;
+    }
+    if(const auto mode = SDL_GetCurrentDisplayMode(SDL_GetDisplayForWindow(wnd))){
+        screen_width = int(mode->w * mode->pixel_density);
+        screen_height = int(mode->h * mode->pixel_density);
+    }
+}
+
+bool SDLRenderer::request_redraw(){
+    std::scoped_lock lck(presenter_mutex);
+    if(!wake_presenter)
+        return false;
+    redraw_pending = true;
+    wake_presenter();
+    return true;
+}
+
+void SDLRenderer::setPresenter(std::function<void()> wake){
+    std::scoped_lock lck(presenter_mutex);
+    wake_presenter = std::move(wake);
+}
+
+void SDLRenderer::handlePendingRedraw(){
+    if(redraw_pending.exchange(false))
+        refreshDisplay();
+}
+
+void SDLRenderer::releaseContext(){
+    if(SDL_GL_GetCurrentContext())
+        SDL_GL_MakeCurrent(wnd, nullptr);
+}
+
+/* Not every renderer converts from every YUV matrix, so each one is tried on a small texture */
+void SDLRenderer::probeColorSpaces(){
+    static constexpr SDL_PixelFormat yuv_fmts[] = {SDL_PIXELFORMAT_NV12, SDL_PIXELFORMAT_IYUV};
+    const auto yuv_fmt = std::find_first_of(supported_sdl_pix_fmts.begin(), supported_sdl_pix_fmts.end(),
+                                            std::begin(yuv_fmts), std::end(yuv_fmts));
+    if(yuv_fmt == supported_sdl_pix_fmts.end())
+        return;
+
+    for(const auto avcs : sdl_candidate_color_spaces){
+        const auto colorspace = SDL_DEFINE_COLORSPACE(SDL_COLOR_TYPE_YCBCR, SDL_COLOR_RANGE_LIMITED,
+                                                      SDL_COLOR_PRIMARIES_BT709, SDL_TRANSFER_CHARACTERISTICS_BT709,
+                                                      SDL_MatrixCoefficients(avcs), SDL_CHROMA_LOCATION_LEFT);
+        if(const auto tex = create_texture(renderer, *yuv_fmt, colorspace, 16, 16)){
+            supported_color_spaces.push_back(avcs);
+            SDL_DestroyTexture(tex);
+        }
+    }
+}
+
+std::vector<AVColorSpace> SDLRenderer::supportedColorSpaces() const{
+    return supported_color_spaces;
+}
+
+QSize SDLRenderer::outputSize() const{
+    return QSize(output_width, output_height);
+}
+
+QSize SDLRenderer::screenSize() const{
+    return QSize(screen_width, screen_height);
+}
+
 void SDLRenderer::refreshDisplay(){
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, SDL_ALPHA_OPAQUE);
     SDL_RenderClear(renderer);
-    if(!vid_texture){ SDL_RenderPresent(renderer); return; }
-
-    const auto rect = calculate_display_rect(0, 0, window_width, window_height, last_frame_width, last_frame_height, last_sar);
+    if(shown_texture < 0){ SDL_RenderPresent(renderer); return; }
+    const auto& vt = vid_textures[shown_texture];
+
+    /* a picture turned by 90 degrees is laid out with its sides swapped, then the texture is drawn
+     * unturned over the same center, so that the rotation makes it cover that rect */
+    const bool transposed = vt.orientation.isTransposed();
+    const AVRational sar = (transposed && vt.sar.num) ? av_make_q(vt.sar.den, vt.sar.num) : vt.sar;
+    auto rect = calculate_display_rect(0, 0, window_width, window_height,
+                                       transposed ? vt.height : vt.width,
+                                       transposed ? vt.width : vt.height, sar);
+    if (transposed) {
+        const float cx = rect.x + rect.w / 2, cy = rect.y + rect.h / 2;
+        std::swap(rect.w, rect.h);
+        rect.x = cx - rect.w / 2;
+        rect.y = cy - rect.h / 2;
+    }
 
-    const auto res = SDL_RenderTextureRotated(renderer, vid_texture, NULL, &rect, 0, NULL, flip_v ? SDL_FLIP_VERTICAL : SDL_FLIP_NONE);
+    int flip = SDL_FLIP_NONE;
+    if (vt.orientation.hflip)
+        flip |= SDL_FLIP_HORIZONTAL;
+    if (vt.orientation.vflip != vt.flip_v)
+        flip |= SDL_FLIP_VERTICAL;
+    const auto res = SDL_RenderTextureRotated(renderer, vt.tex, NULL, &rect, vt.orientation.rotation, NULL, SDL_FlipMode(flip));
     SDL_RenderPresent(renderer);
 }
 
 void SDLRenderer::clearDisplay(){
     if(sub_texture)
         SDL_DestroyTexture(sub_texture);
-    if(vid_texture)
-        SDL_DestroyTexture(vid_texture);
-    sub_texture = vid_texture = nullptr;
-    last_frame_width = last_frame_height = 0;
-    last_frame_format = AV_PIX_FMT_NONE;
+    sub_texture = nullptr;
+    for(auto& vt : vid_textures){
+        if(vt.tex)
+            SDL_DestroyTexture(vt.tex);
+        vt = {};
+    }
+    shown_texture = -1;
 }
 
 static std::pair<SDL_PixelFormat, SDL_BlendMode> get_sdl_pix_fmt_and_blendmode(AVPixelFormat format)
@@ -273,31 +434,142 @@ static std::pair<SDL_PixelFormat, SDL_BlendMode> get_sdl_pix_fmt_and_blendmode(A
     return {sdl_pix_fmt, sdl_blendmode};
 }
 
-bool SDLRenderer::updateVideoTexture(AVFrameView img){
-    if(last_frame_width != img.width() || last_frame_height != img.height() || last_frame_format != img.pixFmt()){
+struct TexturePlane {
+    uint8_t* data;
+    int pitch;
+};
+
+/* The planes of a locked texture follow each other, the chroma ones have half the pitch of the
+ * luma plane, or the same pitch when U and V are interleaved. SDL doesn't document this, it is the
+ * layout of the buffer its renderers keep for the locked YUV and NV textures(the one the
+ * SDL_Update*Texture calls write to as well), and has to follow it. Returns the number of planes */
+static int get_locked_planes(AVPixelFormat format, void* pixels, int pitch, int h, TexturePlane planes[3])
+{
+    const auto base = static_cast<uint8_t*>(pixels);
+    const int ch = AV_CEIL_RSHIFT(h, 1);
+    planes[0] = {base, pitch};
+    switch (format) {
+    case AV_PIX_FMT_YUV420P:
+        planes[1] = {base + ptrdiff_t(pitch) * h, (pitch + 1) / 2};
+        planes[2] = {planes[1].data + ptrdiff_t(planes[1].pitch) * ch, (pitch + 1) / 2};
+        return 3;
+    case AV_PIX_FMT_NV12:
+    case AV_PIX_FMT_NV21:
+    case AV_PIX_FMT_P010:
+        planes[1] = {base + ptrdiff_t(pitch) * h, 2 * ((pitch + 1) / 2)};
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+/* Rows y0 to y1 of a plane, as a single copy when the frame and the texture have the same pitch */
+static void copy_plane_rows(TexturePlane dst, const uint8_t* src, int linesize, int bytes, int y0, int y1)
+{
+    if (y1 <= y0)
+        return;
+    if (linesize == dst.pitch) {
+        memcpy(dst.data + ptrdiff_t(y0) * dst.pitch, src + ptrdiff_t(y0) * linesize,
+               ptrdiff_t(y1 - y0 - 1) * dst.pitch + bytes);
+        return;
+    }
+    for (int y = y0; y < y1; y++)
+        memcpy(dst.data + ptrdiff_t(y) * dst.pitch, src + ptrdiff_t(y) * linesize, bytes);
+}
+
+/* Copies the frame straight into the memory of the locked texture, instead of the SDL_Update*Texture
+ * calls copying it on this thread(and some drivers through an intermediate buffer). The rows are split
+ * in slices copied in parallel, each one covering the chroma rows of its luma rows */
+bool SDLRenderer::upload_locked(SDL_Texture* texture, AVFrameView img){
+    void* pixels = nullptr;
+    int pitch = 0;
+    const auto fmt = img.pixFmt();
+    const int w = img.width(), h = img.height();
+    TexturePlane planes[3];
+    const int nb_planes = get_locked_planes(fmt, nullptr, 0, h, planes);
+
+    /* the rows are copied in memory order, like the SDL_Update*Texture calls get them: a frame with
+     * negative linesizes is flipped when rendered(flip_v) */
+    const uint8_t* src[3] = {};
+    int linesize[3] = {}, bytes[3] = {};
+    for (int i = 0; i < nb_planes; i++) {
+        const int rows = i ? AV_CEIL_RSHIFT(h, 1) : h;
+        src[i] = img.constDataPlane(i);
+        linesize[i] = img.linesize(i);
+        if ((linesize[i] < 0) != (linesize[0] < 0))
+            return false;
+        if (linesize[i] < 0) {
+            src[i] += ptrdiff_t(linesize[i]) * (rows - 1);
+            linesize[i] = -linesize[i];
+        }
+        bytes[i] = av_image_get_linesize(fmt, w, i);
+    }
+
+    if (!SDL_LockTexture(texture, nullptr, &pixels, &pitch))
+        return false;
+    get_locked_planes(fmt, pixels, pitch, h, planes);
+
+    /*even boundaries, so that the 4:2:0 chroma rows aren't split between slices*/
+    const int count = std::clamp(h / UPLOAD_MIN_SLICE_ROWS, 1, upload_workers.count());
+    upload_workers.run(count, [&](int slice, int){
+        const int y0 = (h * slice / count) & ~1;
+        const int y1 = slice == count - 1 ? h : (h * (slice + 1) / count) & ~1;
+        copy_plane_rows(planes[0], src[0], linesize[0], bytes[0], y0, y1);
+        for (int i = 1; i < nb_planes; i++)
+            copy_plane_rows(planes[i], src[i], linesize[i], bytes[i],
+                            y0 >> 1, slice == count - 1 ? AV_CEIL_RSHIFT(h, 1) : y1 >> 1);
+    });
+
+    SDL_UnlockTexture(texture);
+    return true;
+}
+
+/* The texture that was used the longest ago, never the one shown: the GPU may still be reading it */
+int SDLRenderer::free_texture() const{
+    int oldest = -1;
+    for(int i = 0; i < VIDEO_TEXTURE_RING_SIZE; ++i){
+        if(i != shown_texture && (oldest < 0 || vid_textures[i].uploaded_at < vid_textures[oldest].uploaded_at))
+            oldest = i;
+    }
+    return oldest;
+}
+
+bool SDLRenderer::upload(VideoTexture& vt, AVFrameView img){
+    const auto colorspace = get_sdl_colorspace(img);
+    if(vt.width != img.width() || vt.height != img.height() || vt.format != img.pixFmt() || vt.colorspace != colorspace){
         const auto [sdl_pix_fmt, sdl_blendmode] = get_sdl_pix_fmt_and_blendmode(img.pixFmt());
-        if(!realloc_texture(renderer, &vid_texture, sdl_pix_fmt,
+        if(!realloc_texture(renderer, &vt.tex, sdl_pix_fmt,
                              img.width(), img.height(), sdl_blendmode, img)){
             qDebug() << "Failed to create a video texture!";
+            if(vt.tex)
+                SDL_DestroyTexture(vt.tex);
+            vt = {};
             return false;
         }
-        last_frame_height = img.height();
-        last_frame_width = img.width();
-        last_frame_format = img.pixFmt();
-        last_sar = img.sampleAR();
+        vt.height = img.height();
+        vt.width = img.width();
+        vt.format = img.pixFmt();
+        vt.colorspace = colorspace;
     }
 
-    flip_v = img.flipV();
+    vt.sar = img.sampleAR();
+    vt.flip_v = img.flipV();
+    vt.orientation = img.orientation();
+    vt.key = nullptr;
+    vt.uploaded_at = gettime();
+
+    if (upload_locked(vt.tex, img))
+        return true;
 
     bool ret = false;
     switch (img.pixFmt()) {
     case AV_PIX_FMT_YUV420P:
         if (img.linesize(0) > 0 && img.linesize(1) > 0 && img.linesize(2) > 0) {
-            ret = SDL_UpdateYUVTexture(vid_texture, NULL, img.constDataPlane(0), img.linesize(0),
+            ret = SDL_UpdateYUVTexture(vt.tex, NULL, img.constDataPlane(0), img.linesize(0),
                                        img.constDataPlane(1), img.linesize(1),
                                        img.constDataPlane(2), img.linesize(2));
         } else if (img.linesize(0) < 0 && img.linesize(1) < 0 && img.linesize(2) < 0) {
-            ret = SDL_UpdateYUVTexture(vid_texture, NULL, img.constDataPlane(0) + img.linesize(0) * (img.height() - 1), -img.linesize(0),
+            ret = SDL_UpdateYUVTexture(vt.tex, NULL, img.constDataPlane(0) + img.linesize(0) * (img.height() - 1), -img.linesize(0),
                                        img.constDataPlane(1) + img.linesize(1) * (AV_CEIL_RSHIFT(img.height(), 1) - 1), -img.linesize(1),
                                        img.constDataPlane(2) + img.linesize(2) * (AV_CEIL_RSHIFT(img.height(), 1) - 1), -img.linesize(2));
         } else {
@@ -307,13 +579,13 @@ bool SDLRenderer::updateVideoTexture(AVFrameView img){
         break;
     case AV_PIX_FMT_NV12:
     case AV_PIX_FMT_NV21:
-        ret = SDL_UpdateNVTexture(vid_texture, nullptr, img.constDataPlane(0), img.linesize(0), img.constDataPlane(1), img.linesize(1));
+        ret = SDL_UpdateNVTexture(vt.tex, nullptr, img.constDataPlane(0), img.linesize(0), img.constDataPlane(1), img.linesize(1));
         break;
     default:
         if (img.linesize(0) < 0) {
-            ret = SDL_UpdateTexture(vid_texture, nullptr, img.constDataPlane(0) + img.linesize(0) * (img.height() - 1), -img.linesize(0));
+            ret = SDL_UpdateTexture(vt.tex, nullptr, img.constDataPlane(0) + img.linesize(0) * (img.height() - 1), -img.linesize(0));
         } else {
-            ret = SDL_UpdateTexture(vid_texture, nullptr, img.constDataPlane(0), img.linesize(0));
+            ret = SDL_UpdateTexture(vt.tex, nullptr, img.constDataPlane(0), img.linesize(0));
         }
         break;
     }
@@ -321,6 +593,39 @@ bool SDLRenderer::updateVideoTexture(AVFrameView img){
     return ret;
 }
 
+bool SDLRenderer::updateVideoTexture(AVFrameView img){
+    const int idx = free_texture();
+    if(!upload(vid_textures[idx], img))
+        return false;
+    shown_texture = idx;
+    return true;
+}
+
+bool SDLRenderer::preloadVideoTexture(AVFrameView img, const void* key){
+    /*a picture uploaded twice is shown from its last upload*/
+    for(auto& vt : vid_textures){
+        if(vt.key == key)
+            vt.key = nullptr;
+    }
+    auto& vt = vid_textures[free_texture()];
+    if(!upload(vt, img))
+        return false;
+    vt.key = key;
+    return true;
+}
+
+double SDLRenderer::showPreloaded(const void* key){
+    for(int i = 0; i < VIDEO_TEXTURE_RING_SIZE; ++i){
+        auto& vt = vid_textures[i];
+        if(key && vt.key == key && vt.tex){
+            vt.key = nullptr;
+            shown_texture = i;
+            return gettime() - vt.uploaded_at;
+        }
+    }
+    return NAN;
+}
+
 std::vector<AVPixelFormat> SDLRenderer::supportedFormats() const{
     return supported_avpix_fmts;
 }
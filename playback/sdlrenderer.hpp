@@ -6,8 +6,16 @@
 #include <QWidget>
 #include <QTimer>
 #include <vector>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <functional>
 
 #include "avframeview.hpp"
+#include "sliceworkers.hpp"
+
+/* the shown picture, the next one uploaded ahead of its deadline, and a spare one */
+#define VIDEO_TEXTURE_RING_SIZE 3
 
 
 class SDLRenderer final : public QObject
@@ -17,21 +25,50 @@ class SDLRenderer final : public QObject
 
     SDL_Window* wnd = nullptr;
     SDL_Renderer* renderer = nullptr;
-    SDL_Texture* sub_texture = nullptr, *vid_texture = nullptr;
+    /* A picture uploaded to one of the video textures, with what it's displayed with */
+    struct VideoTexture {
+        SDL_Texture* tex = nullptr;
+        int width = 0, height = 0;
+        AVPixelFormat format = AV_PIX_FMT_NONE;
+        SDL_Colorspace colorspace = SDL_COLORSPACE_UNKNOWN;
+        AVRational sar = {};
+        bool flip_v = false;
+        DisplayOrientation orientation;
+        const void* key = nullptr; /*of the preloaded picture, null once shown*/
+        double uploaded_at = 0.0;
+    };
+
+    SDL_Texture* sub_texture = nullptr;
+    /*the pictures are uploaded ahead to the textures not shown*/
+    std::array<VideoTexture, VIDEO_TEXTURE_RING_SIZE> vid_textures;
+    int shown_texture = -1;
     std::vector<SDL_PixelFormat> supported_sdl_pix_fmts;
     std::vector<AVPixelFormat> supported_avpix_fmts;
+    std::vector<AVColorSpace> supported_color_spaces;
 
-    int window_width = 0, window_height = 0;
-    int last_frame_width = 0, last_frame_height = 0;
-    AVPixelFormat last_frame_format = AV_PIX_FMT_NONE;
-    AVRational last_sar = {};
-    bool flip_v = false;
+    std::atomic<int> window_width = 0, window_height = 0;
+    /*in pixels, from the window events on the GUI thread. Atomic, as the presentation thread reads
+     * them for the display downscaling of the video track*/
+    std::atomic<int> output_width = 0, output_height = 0;
+    std::atomic<int> screen_width = 0, screen_height = 0;
+    SliceWorkers upload_workers;
 
     QTimer event_timer;
 
+    /*the thread presenting the video draws, the window events only ask it to redraw*/
+    std::mutex presenter_mutex;
+    std::function<void()> wake_presenter;
+    std::atomic_bool redraw_pending = false;
+
     uintptr_t getWindowHandle();
     Q_SLOT void handleSDLEvents();
     void processSDLEvent(const SDL_Event& evt);
+    void updateOutputSize();
+    void probeColorSpaces();
+    bool request_redraw();
+    bool upload_locked(SDL_Texture* texture, AVFrameView frame);
+    bool upload(VideoTexture& vt, AVFrameView frame);
+    int free_texture() const;
 
 public:
     SDLRenderer(QObject* parent = nullptr);
@@ -40,10 +77,27 @@ public:
     QWidget* toWidget(QWidget* parent);
 
     std::vector<AVPixelFormat> supportedFormats() const;
+    /*The YUV matrices the renderer converts from by itself*/
+    std::vector<AVColorSpace> supportedColorSpaces() const;
+    /*Size of the area the video is drawn to and of the screen the window is on, in pixels. Thread safe*/
+    QSize outputSize() const;
+    QSize screenSize() const;
 
     bool updateVideoTexture(AVFrameView frame);
+    /*Uploads a picture ahead of its display, to one of the textures not shown. key identifies the picture*/
+    bool preloadVideoTexture(AVFrameView frame, const void* key);
+    /*Shows the picture preloaded with key, returns how long ago it was uploaded, or NAN if it wasn't*/
+    double showPreloaded(const void* key);
     void refreshDisplay();
     void clearDisplay();
+
+    /*While a thread presents the video, only that thread draws, wake is called when the window
+     * has to be redrawn. Set from the GUI thread, an empty wake gives the drawing back to it*/
+    void setPresenter(std::function<void()> wake);
+    /*Redraws if the window changed since the last call, from the presenting thread*/
+    void handlePendingRedraw();
+    /*The GL context stays current on the thread that drew last, it is released before another one draws*/
+    void releaseContext();
 };
 
 #endif // SDLRENDERER_HPP
@@ -0,0 +1,72 @@
+#include "sliceworkers.hpp"
+
+#include <algorithm>
+
+SliceWorkers::SliceWorkers(int max_threads)
+{
+    const int threads = std::clamp(int(std::thread::hardware_concurrency()), 1, std::max(max_threads, 1));
+    for (int i = 1; i < threads; i++)
+        workers.emplace_back(&SliceWorkers::worker_loop, this, i);
+}
+
+SliceWorkers::~SliceWorkers()
+{
+    {
+        std::scoped_lock lck(mutex);
+        quit = true;
+    }
+    work_cond.notify_all();
+    for (auto& thr : workers)
+        thr.join();
+}
+
+void SliceWorkers::worker_loop(int worker)
+{
+    uint64_t seen_job = 0;
+    std::unique_lock lck(mutex);
+    for (;;) {
+        work_cond.wait(lck, [&]{return quit || job_id != seen_job;});
+        if (quit)
+            return;
+        seen_job = job_id;
+        const SliceFunc *fn = job;
+        while (fn && next_slice < nb_slices) {
+            const int slice = next_slice++;
+            lck.unlock();
+            (*fn)(slice, worker);
+            lck.lock();
+            if (++slices_done == nb_slices)
+                done_cond.notify_one();
+        }
+    }
+}
+
+void SliceWorkers::run(int slices, const SliceFunc& fn)
+{
+    if (slices <= 1 || workers.empty()) {
+        for (int i = 0; i < slices; i++)
+            fn(i, 0);
+        return;
+    }
+
+    std::unique_lock lck(mutex);
+    job = &fn;
+    nb_slices = slices;
+    next_slice = slices_done = 0;
+    ++job_id;
+    work_cond.notify_all();
+    while (next_slice < nb_slices) {
+        const int slice = next_slice++;
+        lck.unlock();
+        fn(slice, 0);
+        lck.lock();
+        ++slices_done;
+    }
+    done_cond.wait(lck, [this]{return slices_done == nb_slices;});
+    job = nullptr;
+}
+
+int SliceWorkers::count() const
+{
+    return int(workers.size()) + 1;
+}
@@ -0,0 +1,42 @@
+#ifndef SLICEWORKERS_HPP
+#define SLICEWORKERS_HPP
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <cstdint>
+
+#include <QtGlobal>
+
+/* A small pool of threads that process the slices of a picture. run() hands the slices out to the
+ * workers and to the calling thread, and returns once they are all done */
+class SliceWorkers final
+{
+    Q_DISABLE_COPY_MOVE(SliceWorkers);
+public:
+    /*worker is 0 for the calling thread, below count() for the others*/
+    using SliceFunc = std::function<void(int slice, int worker)>;
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable work_cond, done_cond;
+    const SliceFunc* job = nullptr;
+    uint64_t job_id = 0;
+    int nb_slices = 0, next_slice = 0, slices_done = 0;
+    bool quit = false;
+
+    void worker_loop(int worker);
+
+public:
+    /*max_threads includes the calling thread, bounded by the number of cores*/
+    SliceWorkers(int max_threads);
+    ~SliceWorkers();
+
+    void run(int slices, const SliceFunc& fn);
+    int count() const;
+};
+
+#endif // SLICEWORKERS_HPP
@@ -1,6 +1,6 @@
 #include "subtrack.hpp"
 
-SubTrack::SubTrack(const CAVStream& st, std::condition_variable& cond) : AVTrack(st, cond), sub_pool(pkts, SUBPICTURE_QUEUE_SIZE, 0) {
+SubTrack::SubTrack(const CAVStream& st, WakeupEvent& demux_wakeup) : AVTrack(st, demux_wakeup), sub_pool(pkts, SUBPICTURE_QUEUE_SIZE, 0) {
     dec.decoder_thr = std::thread(&SubTrack::run, this);
 }
 
@@ -13,7 +13,7 @@ private:
     void run();
 
 public:
-    SubTrack(const CAVStream& st, std::condition_variable&);
+    SubTrack(const CAVStream& st, WakeupEvent&);
     ~SubTrack();
 
     CSubtitle* peekCurrent();
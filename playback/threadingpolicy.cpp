@@ -0,0 +1,114 @@
+#include "threadingpolicy.hpp"
+
+#include <thread>
+#include <algorithm>
+
+#include <QStringList>
+
+std::atomic<int> ThreadingPolicy::threads_in_use = 0;
+
+static ThreadingPolicy::Mode parse_mode(const QString& str){
+    if(str == "frame")
+        return ThreadingPolicy::MODE_FRAME;
+    if(str == "slice")
+        return ThreadingPolicy::MODE_SLICE;
+    return ThreadingPolicy::MODE_AUTO;
+}
+
+/* threads to aim for, before the budget is applied */
+static int threads_for_stream(const CAVStream& st){
+    const int64_t pixels = int64_t(st.width()) * st.height();
+    int threads = 16;
+    if(pixels <= 720 * 576)
+        threads = 2;
+    else if(pixels <= 1920 * 1088)
+        threads = 4;
+    else if(pixels <= 4096 * 2304)
+        threads = 8;
+
+    /*the older codecs are cheap to decode, more threads only add overhead*/
+    switch(st.codecPar().codec_id){
+    case AV_CODEC_ID_MPEG1VIDEO:
+    case AV_CODEC_ID_MPEG2VIDEO:
+    case AV_CODEC_ID_MPEG4:
+    case AV_CODEC_ID_H263:
+    case AV_CODEC_ID_MJPEG:
+    case AV_CODEC_ID_VP8:
+        threads = std::max(threads / 2, 1);
+        break;
+    default:
+        break;
+    }
+
+    return threads;
+}
+
+/* overrides: comma separated list of codec=threads[:frame|slice], e.g. "h264=4:frame,hevc=8" */
+ThreadingPolicy::ThreadingPolicy(const PlayerOptions& opts) : mode(parse_mode(opts.decoder_thread_mode)) {
+    budget = opts.decoder_threads_budget > 0 ? opts.decoder_threads_budget : int(std::thread::hardware_concurrency());
+    budget = std::max(budget, 1);
+
+    const auto list = opts.decoder_thread_overrides.split(',', Qt::SkipEmptyParts);
+    for(const auto& item : list){
+        const auto kv = item.trimmed().split('=');
+        if(kv.size() != 2)
+            continue;
+        const auto val = kv[1].split(':');
+        Override ovr;
+        bool ok = false;
+        const int threads = val[0].toInt(&ok);
+        if(ok && threads > 0)
+            ovr.threads = threads;
+        if(val.size() > 1)
+            ovr.mode = parse_mode(val[1]);
+        overrides[kv[0].trimmed().toStdString()] = ovr;
+    }
+}
+
+DecoderConfig ThreadingPolicy::decoderConfig(const CAVStream& st, bool low_delay) const{
+    DecoderConfig cfg;
+    const auto codec = st.getCodec();
+    if(!st.isVideo() || !codec)
+        return cfg;
+
+    Override ovr;
+    const auto it = overrides.find(avcodec_get_name(st.codecPar().codec_id));
+    if(it != overrides.end())
+        ovr = it->second;
+
+    const bool can_frame = codec->capabilities & AV_CODEC_CAP_FRAME_THREADS;
+    const bool can_slice = codec->capabilities & AV_CODEC_CAP_SLICE_THREADS;
+    const auto chosen_mode = (ovr.mode != MODE_AUTO) ? ovr.mode : mode;
+    const bool want_slice = (chosen_mode == MODE_SLICE) || (chosen_mode == MODE_AUTO && low_delay);
+    if(want_slice)
+        cfg.thread_type = can_slice ? FF_THREAD_SLICE : (can_frame ? FF_THREAD_FRAME : 0);
+    else
+        cfg.thread_type = can_frame ? FF_THREAD_FRAME : (can_slice ? FF_THREAD_SLICE : 0);
+
+    if(!cfg.thread_type){
+        cfg.thread_count = 1;
+    } else if(ovr.threads > 0){
+        cfg.thread_count = ovr.threads;
+    } else{
+        const int available = std::max(budget - threadsInUse(), 1);
+        cfg.thread_count = std::clamp(threads_for_stream(st), 1, available);
+    }
+
+    av_log(NULL, AV_LOG_VERBOSE, "Decoder threading for %s %dx%d: %d %s threads(%d of %d threads in use)\n",
+           codec->name, st.width(), st.height(), cfg.thread_count,
+           cfg.thread_type == FF_THREAD_FRAME ? "frame" : (cfg.thread_type == FF_THREAD_SLICE ? "slice" : "no"),
+           threadsInUse(), budget);
+    return cfg;
+}
+
+void ThreadingPolicy::acquire(int threads){
+    threads_in_use += threads;
+}
+
+void ThreadingPolicy::release(int threads){
+    threads_in_use -= threads;
+}
+
+int ThreadingPolicy::threadsInUse(){
+    return threads_in_use.load();
+}
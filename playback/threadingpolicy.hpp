@@ -0,0 +1,49 @@
+#ifndef THREADINGPOLICY_HPP
+#define THREADINGPOLICY_HPP
+
+#include <map>
+#include <string>
+#include <atomic>
+
+#include <QtGlobal>
+
+#include "cavstream.hpp"
+#include "decoder.hpp"
+#include "playeroptions.hpp"
+
+/* Decides how the decoders are threaded. Frame threading has the best throughput, but delays
+ * the output by a frame per thread, so the low delay(live) sources use slice threading instead.
+ * The number of threads grows with the resolution and the complexity of the codec, and is bounded
+ * by a budget of cores shared by all the decoders of the process, so that several open players
+ * don't oversubscribe the CPU. Both choices can be overridden per codec. */
+class ThreadingPolicy final
+{
+    Q_DISABLE_COPY_MOVE(ThreadingPolicy);
+public:
+    enum Mode{MODE_AUTO, MODE_FRAME, MODE_SLICE};
+
+private:
+    struct Override {
+        int threads = -1; /*-1: not overridden*/
+        Mode mode = MODE_AUTO;
+    };
+
+    int budget = 1;
+    Mode mode = MODE_AUTO;
+    std::map<std::string, Override> overrides;
+
+    static std::atomic<int> threads_in_use;
+
+public:
+    ThreadingPolicy(const PlayerOptions& opts);
+
+    /*low_delay: the frames must be output as soon as possible(realtime sources)*/
+    DecoderConfig decoderConfig(const CAVStream& st, bool low_delay) const;
+
+    /*Process wide accounting of the decoder threads, done by the decoders themselves*/
+    static void acquire(int threads);
+    static void release(int threads);
+    static int threadsInUse();
+};
+
+#endif // THREADINGPOLICY_HPP
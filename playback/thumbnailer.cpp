@@ -0,0 +1,190 @@
+#include "thumbnailer.hpp"
+#include "formatcontext.hpp"
+#include "packetqueue.hpp"
+#include "decoder.hpp"
+#include "../src/utils.hpp"
+
+#include <optional>
+
+extern "C"{
+#include <libswscale/swscale.h>
+}
+
+/* gives up on a position if no keyframe was found after reading this many packets */
+#define THUMBNAIL_MAX_PACKETS 2000
+
+static int thumbnail_interrupt_cb(void* opaque){
+    return static_cast<std::atomic_bool*>(opaque)->load();
+}
+
+Thumbnailer::Thumbnailer(std::string u, const PlayerOptions& opts, Callback cb) :
+    url(std::move(u)), width(std::max(opts.thumbnail_width, 16)), max_entries(std::max(opts.thumbnail_cache_size, 1)),
+    bucket_s(opts.thumbnail_bucket_s > 0.0 ? opts.thumbnail_bucket_s : 1.0), on_ready(std::move(cb)) {
+    worker.reset(QThread::create([this]{run();}));
+    worker->start(QThread::LowestPriority);
+}
+
+Thumbnailer::~Thumbnailer(){
+    {
+        std::scoped_lock lck(mutex);
+        abort_req = true;
+    }
+    cond.notify_one();
+    worker->wait();
+}
+
+int Thumbnailer::bucket(double pos) const{
+    return int(std::floor(pos / bucket_s));
+}
+
+void Thumbnailer::request(double percent){
+    const double pos = percent * duration_s.load();
+    if(isnan(pos))
+        return;
+
+    QImage cached;
+    {
+        std::scoped_lock lck(mutex);
+        ++stats.requests;
+        const auto it = lru_map.find(bucket(pos));
+        if(it == lru_map.end()){
+            pending_pos = pos;
+            pending_since = Utils::gettime_s();
+        } else{
+            ++stats.hits;
+            lru.splice(lru.begin(), lru, it->second);
+            cached = it->second->img;
+        }
+    }
+
+    if(cached.isNull())
+        cond.notify_one();
+    else
+        on_ready(cached, pos);
+}
+
+Thumbnailer::Stats Thumbnailer::getStats() const{
+    std::scoped_lock lck(mutex);
+    return stats;
+}
+
+void Thumbnailer::insert(int b, const QImage& img, double latency){
+    std::scoped_lock lck(mutex);
+    ++stats.decoded;
+    latency_sum += latency;
+    stats.avg_latency = latency_sum / stats.decoded;
+    stats.max_latency = std::max(stats.max_latency, latency);
+
+    if(lru_map.count(b))
+        return;
+    lru.push_front(Entry{b, img});
+    lru_map[b] = lru.begin();
+    if(int(lru.size()) > max_entries){
+        lru_map.erase(lru.back().bucket);
+        lru.pop_back();
+    }
+}
+
+void Thumbnailer::run(){
+    std::optional<FormatContext> fmt;
+    try{
+        fmt.emplace(url, thumbnail_interrupt_cb, &abort_req);
+    } catch(std::exception& ex){
+        av_log(NULL, AV_LOG_VERBOSE, "Thumbnailer: %s\n", ex.what());
+        return;
+    }
+
+    start_s = fmt->startTimeS();
+    duration_s = fmt->duration();
+
+    const int st_idx = fmt->videoStIdx();
+    if(st_idx < 0 || fmt->streamAt(st_idx).isAttachedPic())
+        return;
+    fmt->setStreamEnabled(st_idx, true);
+    const auto st = fmt->streamAt(st_idx);
+
+    /*the smallest resolution the decoder can output that is still wider than the previews*/
+    int lowres = 0;
+    while(lowres < 3 && (st.width() >> (lowres + 1)) >= width)
+        ++lowres;
+
+    WakeupEvent wakeup;
+    PacketQueue queue(wakeup, 4);
+    std::optional<Decoder> dec;
+    try{
+        dec.emplace(st, queue, DecoderConfig{.lowres = lowres, .thread_count = 1, .skip_frame = AVDISCARD_NONKEY});
+    } catch(std::exception& ex){
+        av_log(NULL, AV_LOG_VERBOSE, "Thumbnailer: %s\n", ex.what());
+        return;
+    }
+    queue.start();
+
+    AVFrame* frame = av_frame_alloc(), *tmp_frame = av_frame_alloc();
+    SwsContext* sws = nullptr;
+    for(;;){
+        double pos = NAN, since = 0.0;
+        {
+            std::unique_lock lck(mutex);
+            cond.wait(lck, [this]{return abort_req.load() || !isnan(pending_pos);});
+            if(abort_req)
+                break;
+            pos = pending_pos;
+            since = pending_since;
+            pending_pos = NAN;
+        }
+        auto superseded = [this]{
+            std::scoped_lock lck(mutex);
+            return abort_req.load() || !isnan(pending_pos);
+        };
+
+        if(!fmt->seekTo(start_s + pos))
+            continue;
+
+        CAVPacket pkt;
+        bool found = false;
+        for(int i = 0; i < THUMBNAIL_MAX_PACKETS && !found && !superseded(); ++i){
+            pkt.unref();
+            if(fmt->read(pkt) < 0)
+                break;
+            found = pkt.streamIndex() == st_idx && (pkt.constAv()->flags & AV_PKT_FLAG_KEY);
+        }
+        if(!found)
+            continue;
+
+        /*the null packet drains the decoder, so the frame comes out right away*/
+        queue.put(std::move(pkt));
+        queue.put_nullpacket(st_idx);
+        bool got_frame = false;
+        int ret;
+        while((ret = dec->decode_frame(tmp_frame, nullptr)) > 0){
+            av_frame_unref(frame);
+            av_frame_move_ref(frame, tmp_frame);
+            got_frame = true;
+        }
+        if(ret < 0)
+            break;
+        if(!got_frame || frame->width <= 0 || frame->height <= 0)
+            continue;
+
+        const auto sar = frame->sample_aspect_ratio.num ? av_q2d(frame->sample_aspect_ratio) : 1.0;
+        const int height = std::max(2, int(std::lrint(width * frame->height / (frame->width * sar))) & ~1);
+        QImage img(width, height, QImage::Format_RGB32);
+        sws = sws_getCachedContext(sws, frame->width, frame->height, AVPixelFormat(frame->format),
+                                   width, height, AV_PIX_FMT_RGB32, SWS_BILINEAR, nullptr, nullptr, nullptr);
+        if(sws){
+            uint8_t* dst[4] = {img.bits()};
+            const int dst_linesize[4] = {int(img.bytesPerLine())};
+            sws_scale(sws, frame->data, frame->linesize, 0, frame->height, dst, dst_linesize);
+            const double latency = Utils::gettime_s() - since;
+            insert(bucket(pos), img, latency);
+            av_log(NULL, AV_LOG_DEBUG, "Thumbnail at %.3f decoded in %.1f ms\n", pos, latency * 1000.0);
+            on_ready(img, pos);
+        }
+        av_frame_unref(frame);
+    }
+
+    queue.abort();
+    sws_freeContext(sws);
+    av_frame_free(&frame);
+    av_frame_free(&tmp_frame);
+}
@@ -0,0 +1,72 @@
+#ifndef THUMBNAILER_HPP
+#define THUMBNAILER_HPP
+
+#include <list>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <cmath>
+
+#include <QImage>
+#include <QThread>
+
+#include "playeroptions.hpp"
+
+/* Produces the seek bar previews. The file is opened a second time and only the keyframes of
+ * the video stream are decoded, at low resolution, on a low priority thread. Nothing is shared
+ * with the playback, so it never waits on the previews. Only the most recent request is served,
+ * the older pending ones are dropped. The results are kept in an LRU cache keyed by time bucket. */
+class Thumbnailer final
+{
+    Q_DISABLE_COPY_MOVE(Thumbnailer);
+public:
+    /*Called with the preview and its position relative to the start of the file,
+     * from the worker thread unless it was cached*/
+    using Callback = std::function<void(QImage, double)>;
+
+    struct Stats {
+        int requests = 0, hits = 0, decoded = 0;
+        double avg_latency = 0.0, max_latency = 0.0; /*of the decoded previews, in seconds*/
+    };
+
+private:
+    struct Entry {
+        int bucket = 0;
+        QImage img;
+    };
+
+    const std::string url;
+    const int width, max_entries;
+    const double bucket_s;
+    const Callback on_ready;
+
+    mutable std::mutex mutex;
+    std::condition_variable cond;
+    std::list<Entry> lru; /*most recently used first*/
+    std::unordered_map<int, std::list<Entry>::iterator> lru_map;
+    double pending_pos = NAN, pending_since = 0.0;
+    Stats stats;
+    double latency_sum = 0.0;
+
+    /*known once the worker opened the file*/
+    std::atomic<double> duration_s = NAN, start_s = 0.0;
+    std::atomic_bool abort_req = false;
+    std::unique_ptr<QThread> worker;
+
+    int bucket(double pos) const;
+    void run();
+    void insert(int bucket, const QImage& img, double latency);
+
+public:
+    Thumbnailer(std::string url, const PlayerOptions& opts, Callback on_ready);
+    ~Thumbnailer();
+
+    /*percent of the duration, ignored until the file is opened by the worker*/
+    void request(double percent);
+    Stats getStats() const;
+};
+
+#endif // THUMBNAILER_HPP
@@ -1,5 +1,8 @@
 #include "videotrack.hpp"
 
+#include <algorithm>
+#include <optional>
+
 extern "C"{
 #include <libavutil/display.h>
 #include <libavfilter/buffersrc.h>
@@ -8,8 +11,28 @@ extern "C"{
 #include <libavutil/avstring.h>
 }
 
-VideoTrack::VideoTrack(const CAVStream& st, std::condition_variable& empty_q_cond, const std::vector<AVPixelFormat>& fmts) :
-    AVTrack(st, empty_q_cond), frame_pool(pkts, VIDEO_PICTURE_QUEUE_SIZE, 1), supported_pix_fmts(fmts) {
+/* the delays are smoothed as avg = avg * (1 - EARLY_DROP_DELAY_WEIGHT) + sample * EARLY_DROP_DELAY_WEIGHT */
+#define EARLY_DROP_DELAY_WEIGHT 0.1
+/* a frame this late means a clock discontinuity rather than a slow decoder */
+#define EARLY_DROP_MAX_LATENESS 10.0
+/* keeps the picture moving when nothing can be decoded in time */
+#define EARLY_DROP_MAX_IN_ROW 8
+
+/* the frames are scaled down once they would be displayed at less than this share of their size... */
+#define DISPLAY_SCALE_START 0.75
+/* ...and back to their size once they would be displayed at more than this share of it */
+#define DISPLAY_SCALE_STOP 0.9
+/* while scaled, smaller changes of the display size than these factors keep the scaled size */
+#define DISPLAY_SCALE_SHRINK 0.8
+#define DISPLAY_SCALE_GROW 1.05
+/* the scaled size(and so the filter graph) changes at most this often, in seconds */
+#define DISPLAY_SCALE_MIN_INTERVAL 0.5
+
+VideoTrack::VideoTrack(const CAVStream& st, WakeupEvent& demux_wakeup, const std::vector<AVPixelFormat>& fmts,
+                       const std::vector<AVColorSpace>& color_spaces, const PlayerOptions& opts, const DecoderConfig& dec_cfg) :
+    AVTrack(st, demux_wakeup, dec_cfg), frame_pool(pkts, VIDEO_PICTURE_QUEUE_SIZE, 1), supported_pix_fmts(fmts),
+    supported_color_spaces(color_spaces),
+    qos(opts.qos, opts.qos_max_level), early_drop(opts.early_frame_drop), display_downscale(opts.display_downscale) {
     dec.decoder_thr = std::thread(&VideoTrack::run, this);
 }
 
@@ -21,9 +44,11 @@ VideoTrack::~VideoTrack(){
         dec.decoder_thr.join();
 }
 
-void VideoTrack::flush(){
+void VideoTrack::flush(double preroll_target){
     clk.resetTime();
-    AVTrack::flush();
+    master_offset = NAN;
+    flush_time = gettime();
+    AVTrack::flush(preroll_target);
 }
 
 double VideoTrack::curPts() const{return clk.base();}
@@ -41,9 +66,59 @@ double VideoTrack::getClockVal() const{return clk.get();}
 double VideoTrack::clockUpdateTime(){return clk.updatedAt();}
 void VideoTrack::updateClock(double pts){clk.set(pts);}
 void VideoTrack::setPauseStatus(bool p){clk.setPaused(p);}
+void VideoTrack::reportLateDrop(){qos.reportLateDrop();}
+const QosController& VideoTrack::qosStats() const{return qos;}
+void VideoTrack::syncTo(double master_clock){master_offset = master_clock - gettime();}
+int VideoTrack::earlyDrops() const{return early_drops.load();}
+
+void VideoTrack::setDisplaySize(int w, int h){
+    display_w = w;
+    display_h = h;
+}
+
+void VideoTrack::reportUploadTime(double t){
+    upload_delay = upload_delay.load() * (1.0 - EARLY_DROP_DELAY_WEIGHT) + t * EARLY_DROP_DELAY_WEIGHT;
+}
+
+/* True if the frame would still be filtered and uploaded after the master clock passed its end.
+ * The last packets are never dropped, so the stream always ends with a picture */
+bool VideoTrack::is_late(const AVFrame *frame, double fallback_dur)
+{
+    const double offset = master_offset.load();
+    if (!early_drop || isnan(offset) || frame->pts == AV_NOPTS_VALUE || pkts.isEmpty()
+        || early_drops_in_row >= EARLY_DROP_MAX_IN_ROW)
+        return false;
+
+    const double pts = frame->pts * av_q2d(rel_st.tb());
+    const double dur = frame->duration > 0 ? frame->duration * av_q2d(rel_st.tb()) : fallback_dur;
+    const double lateness = gettime() + offset + filter_delay + upload_delay.load() - (pts + dur);
+    return lateness > 0.0 && lateness < EARLY_DROP_MAX_LATENESS;
+}
+
+/* decoder thread only, the codec context picks up the new settings with the next packet */
+void VideoTrack::apply_qos_level()
+{
+    const auto lvl = qos.level();
+    auto avctx = dec.avctx;
+    if (lvl >= QosController::QOS_SKIP_LOOP_FILTER)
+        avctx->skip_loop_filter = AVDISCARD_ALL;
+    else if (lvl >= QosController::QOS_SKIP_LOOP_FILTER_NONREF)
+        avctx->skip_loop_filter = AVDISCARD_NONREF;
+    else
+        avctx->skip_loop_filter = AVDISCARD_DEFAULT;
+
+    if (lvl >= QosController::QOS_SKIP_LOOP_FILTER)
+        avctx->flags2 |= AV_CODEC_FLAG2_FAST;
+    else
+        avctx->flags2 &= ~AV_CODEC_FLAG2_FAST;
+
+    dec.skip_frame_default = (lvl >= QosController::QOS_SKIP_NONREF) ? AVDISCARD_NONREF : AVDISCARD_DEFAULT;
+    avctx->skip_frame = dec.skip_frame_default;
+}
 
 
-int VideoTrack::queue_picture(AVFrame *src_frame, double pts, double duration, int64_t pos, int serial)
+int VideoTrack::queue_picture(AVFrame *src_frame, double pts, double duration, int64_t pos, int serial,
+                              DisplayOrientation orientation)
 {
     CAVFrame *vp;
 
@@ -54,6 +129,7 @@ int VideoTrack::queue_picture(AVFrame *src_frame, double pts, double duration, i
     vp->setTimingInfo(pts, duration);
     vp->setPktPos(pos);
     vp->setSerial(serial);
+    vp->setOrientation(orientation);
 
     av_frame_move_ref(vp->av(), src_frame);
     frame_pool.push();
@@ -73,13 +149,30 @@ int VideoTrack::get_video_frame(AVFrame *frame)
     return got_picture;
 }
 
-static double get_rotation(const int32_t *displaymatrix)
+static const int32_t* get_displaymatrix(const AVFrame *frame, const AVCodecParameters& codecpar)
+{
+    const AVFrameSideData *sd = av_frame_get_side_data(frame, AV_FRAME_DATA_DISPLAYMATRIX);
+    if (sd)
+        return (const int32_t *)sd->data;
+    const AVPacketSideData *psd = av_packet_side_data_get(codecpar.coded_side_data,
+                                                          codecpar.nb_coded_side_data,
+                                                          AV_PKT_DATA_DISPLAYMATRIX);
+    return psd ? (const int32_t *)psd->data : NULL;
+}
+
+static double rotation_angle(const int32_t *displaymatrix)
 {
     double theta = 0;
     if (displaymatrix)
         theta = -round(av_display_rotation_get(displaymatrix));
 
     theta -= 360*floor(theta/360 + 0.9/360);
+    return theta;
+}
+
+static double get_rotation(const int32_t *displaymatrix)
+{
+    const double theta = rotation_angle(displaymatrix);
 
     if (fabs(theta - 90*round(theta/90)) > 2)
         av_log(NULL, AV_LOG_WARNING, "Odd rotation angle.\n"
@@ -90,6 +183,36 @@ static double get_rotation(const int32_t *displaymatrix)
     return theta;
 }
 
+/* The turn the renderer applies for the display matrix. The flips and transpositions the filters
+ * used to do are expressed as flips of the decoded picture followed by a clockwise rotation.
+ * Empty for the angles that aren't a multiple of 90 degrees, those need the rotate filter */
+static std::optional<DisplayOrientation> get_orientation(const int32_t *displaymatrix, double theta)
+{
+    DisplayOrientation o;
+    if (!displaymatrix)
+        return o;
+
+    if (fabs(theta - 90) < 1.0) {
+        o.rotation = 90;
+        o.vflip = displaymatrix[3] > 0; /*transpose*/
+    } else if (fabs(theta - 180) < 1.0) {
+        o.hflip = displaymatrix[0] < 0;
+        o.vflip = displaymatrix[4] < 0;
+    } else if (fabs(theta - 270) < 1.0) {
+        if (displaymatrix[3] < 0) {
+            o.rotation = 90; /*anti-transpose*/
+            o.hflip = true;
+        } else {
+            o.rotation = 270;
+        }
+    } else if (fabs(theta) > 1.0) {
+        return std::nullopt;
+    } else {
+        o.vflip = displaymatrix[4] < 0;
+    }
+    return o;
+}
+
 int VideoTrack::configure_video_filters(AVFilterGraph *graph, const char *vfilters, const AVFrame *frame)
 {
     const auto& pix_fmts = supported_pix_fmts;
@@ -100,6 +223,8 @@ int VideoTrack::configure_video_filters(AVFilterGraph *graph, const char *vfilte
     const AVRational fr = rel_st.frameRate();
     const AVDictionaryEntry *e = NULL;
     AVDictionary* sws_dict = nullptr;
+    /* the scaling to the display size is the most expensive filter, it gets all the cores */
+    av_dict_set(&sws_dict, "threads", "auto", 0);
 
     AVBufferSrcParameters *par = av_buffersrc_parameters_alloc();
 
@@ -116,6 +241,7 @@ int VideoTrack::configure_video_filters(AVFilterGraph *graph, const char *vfilte
         sws_flags_str[strlen(sws_flags_str)-1] = '\0';
 
     graph->scale_sws_opts = av_strdup(sws_flags_str);
+    av_dict_free(&sws_dict);
 
 
     filt_src = avfilter_graph_alloc_filter(graph, avfilter_get_by_name("buffer"),
@@ -152,9 +278,11 @@ int VideoTrack::configure_video_filters(AVFilterGraph *graph, const char *vfilte
     if ((ret = av_opt_set_array(filt_out, "pixel_formats", AV_OPT_SEARCH_CHILDREN,
                                 0, pix_fmts.size(), AV_OPT_TYPE_PIXEL_FMT, pix_fmts.data())) < 0)
         goto fail;
-    if ((ret = av_opt_set_array(filt_out, "colorspaces", AV_OPT_SEARCH_CHILDREN,
-                                0, Decoder::sdl_supported_color_spaces.size(),
-                                AV_OPT_TYPE_INT, Decoder::sdl_supported_color_spaces.data())) < 0)
+    /* the YUV matrices the renderer can convert from, the others are converted here */
+    if (!supported_color_spaces.empty()
+        && (ret = av_opt_set_array(filt_out, "colorspaces", AV_OPT_SEARCH_CHILDREN,
+                                   0, supported_color_spaces.size(),
+                                   AV_OPT_TYPE_INT, supported_color_spaces.data())) < 0)
         goto fail;
 
     ret = avfilter_init_dict(filt_out, NULL);
@@ -181,37 +309,16 @@ int VideoTrack::configure_video_filters(AVFilterGraph *graph, const char *vfilte
         last_filter = filt_ctx;                                                  \
 } while (0)
 
+    /* the multiples of 90 degrees and the flips are applied by the renderer, see get_orientation */
     if (true) {
         double theta = 0.0;
-        int32_t *displaymatrix = NULL;
-        AVFrameSideData *sd = av_frame_get_side_data(frame, AV_FRAME_DATA_DISPLAYMATRIX);
-        if (sd)
-            displaymatrix = (int32_t *)sd->data;
-        if (!displaymatrix) {
-            const AVPacketSideData *psd = av_packet_side_data_get(codecpar.coded_side_data,
-                                                                  codecpar.nb_coded_side_data,
-                                                                  AV_PKT_DATA_DISPLAYMATRIX);
-            if (psd)
-                displaymatrix = (int32_t *)psd->data;
-        }
+        const int32_t *displaymatrix = get_displaymatrix(frame, codecpar);
         theta = get_rotation(displaymatrix);
 
-        if (fabs(theta - 90) < 1.0) {
-            INSERT_FILT("transpose", displaymatrix[3] > 0 ? "cclock_flip" : "clock");
-        } else if (fabs(theta - 180) < 1.0) {
-            if (displaymatrix[0] < 0)
-                INSERT_FILT("hflip", NULL);
-            if (displaymatrix[4] < 0)
-                INSERT_FILT("vflip", NULL);
-        } else if (fabs(theta - 270) < 1.0) {
-            INSERT_FILT("transpose", displaymatrix[3] < 0 ? "clock_flip" : "cclock");
-        } else if (fabs(theta) > 1.0) {
+        if (!get_orientation(displaymatrix, theta)) {
             char rotate_buf[64];
             snprintf(rotate_buf, sizeof(rotate_buf), "%f*PI/180", theta);
             INSERT_FILT("rotate", rotate_buf);
-        } else {
-            if (displaymatrix && displaymatrix[4] < 0)
-                INSERT_FILT("vflip", NULL);
         }
     }
 
@@ -230,6 +337,88 @@ fail:
 return ret;
 }
 
+/* True if the frame is displayed rotated by 90 or 270 degrees */
+static bool is_transposed(const int32_t *displaymatrix)
+{
+    if (!displaymatrix)
+        return false;
+    const double theta = fabs(av_display_rotation_get(displaymatrix));
+    return !isnan(theta) && fabs(fmod(theta, 180.0) - 90.0) < 45.0;
+}
+
+/* Picks the size the frames are scaled down to, so they aren't much larger than the area they are
+ * displayed in. The size only changes when the display size moved past the hysteresis margins,
+ * and not more often than DISPLAY_SCALE_MIN_INTERVAL, so resizing the window doesn't keep
+ * rebuilding the filter graph */
+void VideoTrack::update_display_scale(const AVFrame *frame)
+{
+    const bool new_source = frame->width != scale_src_w || frame->height != scale_src_h;
+    const double now = gettime();
+    if (!new_source && now - scale_changed_at < DISPLAY_SCALE_MIN_INTERVAL)
+        return;
+
+    int dw = display_w, dh = display_h;
+    if (is_transposed(get_displaymatrix(frame, rel_st.codecPar())))
+        std::swap(dw, dh);
+    const double sar = frame->sample_aspect_ratio.num > 0 ? av_q2d(frame->sample_aspect_ratio) : 1.0;
+    const double scale = (display_downscale && dw > 0 && dh > 0 && frame->width > 0 && frame->height > 0)
+                         ? std::min(dw / (frame->width * sar), double(dh) / frame->height) : 1.0;
+
+    int w = 0, h = 0;
+    const bool scaling = scale_w > 0 && !new_source;
+    if (scale < (scaling ? DISPLAY_SCALE_STOP : DISPLAY_SCALE_START)) {
+        /* the pixel aspect ratio is kept, so the display rect doesn't change */
+        w = std::max(2, int(std::lrint(frame->width * scale)) & ~1);
+        h = std::max(2, int(std::lrint(frame->height * scale)) & ~1);
+        if (scaling && w >= scale_w * DISPLAY_SCALE_SHRINK && w <= scale_w * DISPLAY_SCALE_GROW)
+            return;
+    }
+
+    if (new_source || w != scale_w || h != scale_h) {
+        if (w != scale_w || h != scale_h)
+            av_log(NULL, AV_LOG_VERBOSE, "Video frames of %dx%d scaled to %dx%d for the display\n",
+                   frame->width, frame->height, w ? w : frame->width, h ? h : frame->height);
+        scale_w = w;
+        scale_h = h;
+        scale_src_w = frame->width;
+        scale_src_h = frame->height;
+        scale_changed_at = now;
+    }
+}
+
+/* Gives the untagged frames the usual matrix and primaries for their resolution. The renderer would
+ * otherwise pick them from the size of the uploaded picture, which differs once scaled for the display */
+static void tag_default_colors(AVFrame *frame)
+{
+    if (av_pix_fmt_desc_get(AVPixelFormat(frame->format))->flags & AV_PIX_FMT_FLAG_RGB)
+        return;
+    const bool hd = frame->height >= 720;
+    if (frame->colorspace == AVCOL_SPC_UNSPECIFIED)
+        frame->colorspace = hd ? AVCOL_SPC_BT709 : AVCOL_SPC_SMPTE170M;
+    if (frame->color_primaries == AVCOL_PRI_UNSPECIFIED)
+        frame->color_primaries = hd ? AVCOL_PRI_BT709 : AVCOL_PRI_SMPTE170M;
+}
+
+/* True if the frame can be displayed as it comes out of the decoder: the renderer takes its
+ * format(or PixelConverter converts it) and color space, and there is nothing to deinterlace
+ * or rotate by an odd angle */
+bool VideoTrack::can_bypass_filters(const AVFrame *frame) const
+{
+    if (frame->hw_frames_ctx || (frame->flags & AV_FRAME_FLAG_INTERLACED))
+        return false;
+    if (std::find(supported_pix_fmts.begin(), supported_pix_fmts.end(), frame->format) == supported_pix_fmts.end()
+        && PixelConverter::outputFormat(AVPixelFormat(frame->format), supported_pix_fmts) == AV_PIX_FMT_NONE)
+        return false;
+    /* tag_default_colors() already resolved the unspecified matrices */
+    const auto& spaces = supported_color_spaces;
+    if (frame->colorspace != AVCOL_SPC_UNSPECIFIED && !(av_pix_fmt_desc_get(AVPixelFormat(frame->format))->flags & AV_PIX_FMT_FLAG_RGB)
+        && std::find(spaces.begin(), spaces.end(), frame->colorspace) == spaces.end())
+        return false;
+
+    const int32_t *displaymatrix = get_displaymatrix(frame, rel_st.codecPar());
+    return get_orientation(displaymatrix, rotation_angle(displaymatrix)).has_value();
+}
+
 void VideoTrack::run()
 {
     AVFrame *frame = av_frame_alloc();
@@ -242,49 +431,176 @@ void VideoTrack::run()
     int last_w = 0;
     int last_h = 0;
     AVPixelFormat last_format = AV_PIX_FMT_NONE;
+    AVColorSpace last_colorspace = AVCOL_SPC_UNSPECIFIED;
+    AVColorRange last_range = AVCOL_RANGE_UNSPECIFIED;
     int last_serial = -1;
+    int last_out_w = 0, last_out_h = 0;
+    bool bypass = false, graph_stateless = false;
+    AVPixelFormat convert_fmt = AV_PIX_FMT_NONE;
+    AVFrame *conv_frame = av_frame_alloc();
+    DisplayOrientation orientation;
+    bool first_of_serial = false, graph_reused = false;
+    const auto fr = rel_st.frameRate();
+    const double frame_dur = (fr.num && fr.den) ? av_q2d({fr.den, fr.num}) : 0.0;
 
     for (;;) {
+        /* the time spent decoding and filtering each frame is fed to the QoS controller, not the
+         * time spent waiting for the demuxer */
+        double busy_start = gettime();
+        const double queue_wait = dec.queue_wait;
         ret = get_video_frame(frame);
+        busy_start += dec.queue_wait - queue_wait;
         if (ret < 0)
             goto the_end;
         if (!ret)
             continue;
 
-        if (   last_w != frame->width
+        /* the frames of a flushed serial are dropped before any more work is done on them */
+        if (dec.pkt_serial != pkts.serial() || dec.inPreroll(frame, rel_st.tb(), frame_dur)) {
+            av_frame_unref(frame);
+            continue;
+        }
+        /* so are the frames that would be late for display anyway */
+        if (is_late(frame, frame_dur)) {
+            ++early_drops;
+            ++early_drops_in_row;
+            qos.reportLateDrop();
+            av_frame_unref(frame);
+            continue;
+        }
+        early_drops_in_row = 0;
+        tag_default_colors(frame);
+
+        /* the size the frames are uploaded at: that of the display, halved by the QoS if needed */
+        update_display_scale(frame);
+        int out_w = scale_w ? scale_w : frame->width, out_h = scale_h ? scale_h : frame->height;
+        if (qos.level() >= QosController::QOS_HALF_SIZE) {
+            out_w = std::max(2, (out_w / 2) & ~1);
+            out_h = std::max(2, (out_h / 2) & ~1);
+        }
+        const bool scaled = out_w != frame->width || out_h != frame->height;
+
+        const bool serial_changed = last_serial != dec.pkt_serial;
+        const bool params_changed =
+               last_w != frame->width
             || last_h != frame->height
             || last_format != frame->format
-            || last_serial != dec.pkt_serial) {
+            || last_colorspace != frame->colorspace
+            || last_range != frame->color_range
+            || last_out_w != out_w
+            || last_out_h != out_h;
+        if (params_changed) {
             av_log(NULL, AV_LOG_DEBUG,
                    "Video frame changed from size:%dx%d format:%s serial:%d to size:%dx%d format:%s serial:%d\n",
                    last_w, last_h,
                    (const char *)av_x_if_null(av_get_pix_fmt_name(last_format), "none"), last_serial,
                    frame->width, frame->height,
                    (const char *)av_x_if_null(av_get_pix_fmt_name(AVPixelFormat(frame->format)), "none"), dec.pkt_serial);
+            const int32_t *displaymatrix = get_displaymatrix(frame, rel_st.codecPar());
+            orientation = get_orientation(displaymatrix, rotation_angle(displaymatrix)).value_or(DisplayOrientation{});
+            const bool was_bypassed = bypass;
+            bypass = !scaled && can_bypass_filters(frame);
+            convert_fmt = AV_PIX_FMT_NONE;
+            if (bypass && std::find(supported_pix_fmts.begin(), supported_pix_fmts.end(), frame->format) == supported_pix_fmts.end()) {
+                convert_fmt = PixelConverter::outputFormat(AVPixelFormat(frame->format), supported_pix_fmts);
+                if (!converter)
+                    converter = std::make_unique<PixelConverter>();
+                av_log(NULL, AV_LOG_VERBOSE, "Video frames converted from %s to %s(%s, %d threads)\n",
+                       av_get_pix_fmt_name(AVPixelFormat(frame->format)), av_get_pix_fmt_name(convert_fmt),
+                       PixelConverter::simdName(), converter->threadCount());
+            }
+            if (bypass != was_bypassed)
+                av_log(NULL, AV_LOG_VERBOSE, bypass ? "Video frames are displayed as decoded, without filters\n"
+                                                    : "Video frames are sent through the filters\n");
+            last_w = frame->width;
+            last_h = frame->height;
+            last_format = AVPixelFormat(frame->format);
+            last_colorspace = frame->colorspace;
+            last_range = frame->color_range;
+            last_out_w = out_w;
+            last_out_h = out_h;
+        }
+
+        if (bypass) {
+            avfilter_graph_free(&graph);
+        } else if (!graph || params_changed || (serial_changed && !graph_stateless)) {
+            /* a seek only needs a new graph if the old one may still hold frames from before it */
             avfilter_graph_free(&graph);
             graph = avfilter_graph_alloc();
             if (!graph) {
                 goto the_end;
             }
             graph->nb_threads = 0;
-            if (configure_video_filters(graph, nullptr, frame) < 0) {
+            /* scaling before the rotation, so in the coordinates of the decoded frame */
+            char scale_filter[64];
+            snprintf(scale_filter, sizeof(scale_filter), "scale=%d:%d", out_w, out_h);
+            if (configure_video_filters(graph, scaled ? scale_filter : nullptr, frame) < 0) {
                 goto the_end;
             }
+            graph_stateless = filtergraph_is_stateless(graph);
             filt_in  = in_video_filter;
             filt_out = out_video_filter;
-            last_w = frame->width;
-            last_h = frame->height;
-            last_format = AVPixelFormat(frame->format);
+            graph_reused = false;
+        } else if (serial_changed) {
+            graph_reused = true;
+            av_log(NULL, AV_LOG_DEBUG, "Video filter graph reused for serial %d\n", dec.pkt_serial);
+        }
+        if (serial_changed) {
+            qos.resetWindow();
             last_serial = dec.pkt_serial;
+            first_of_serial = true;
         }
 
+        /* takes the frame, returns false if the picture queue was aborted */
+        auto output_picture = [&](AVRational tb, AVRational frame_rate, double filter_time) {
+            const FrameData *fd = frame->opaque_ref ? (FrameData*)frame->opaque_ref->data : NULL;
+            duration = (frame_rate.num && frame_rate.den ? av_q2d((AVRational){frame_rate.den, frame_rate.num}) : 0);
+            pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(tb);
+
+            if (!isnan(filter_time))
+                filter_delay = filter_delay * (1.0 - EARLY_DROP_DELAY_WEIGHT) + filter_time * EARLY_DROP_DELAY_WEIGHT;
+            if (!isnan(busy_start)) {
+                if (qos.update(gettime() - busy_start, duration > 0 ? duration : frame_dur,
+                               frame_pool.nb_remaining(), VIDEO_PICTURE_QUEUE_SIZE))
+                    apply_qos_level();
+                busy_start = NAN;
+            }
+
+            if (queue_picture(frame, pts, duration, fd ? fd->pkt_pos : -1, dec.pkt_serial, orientation))
+                return false;
+
+            if (first_of_serial) {
+                const double flushed_at = flush_time.exchange(NAN);
+                if (!isnan(flushed_at))
+                    av_log(NULL, AV_LOG_VERBOSE, "First video frame after the flush queued in %.1f ms(filter graph %s)\n",
+                           (gettime() - flushed_at) * 1000.0, bypass ? "bypassed" : graph_reused ? "kept" : "rebuilt");
+                first_of_serial = false;
+            }
+            return true;
+        };
+
+        if (bypass) {
+            double convert_time = 0.0;
+            if (convert_fmt != AV_PIX_FMT_NONE) {
+                const double convert_start = gettime();
+                if (converter->convert(frame, conv_frame, convert_fmt) < 0)
+                    goto the_end;
+                av_frame_unref(frame);
+                av_frame_move_ref(frame, conv_frame);
+                convert_time = gettime() - convert_start;
+            }
+            /* the same time base and frame rate the buffer source would be given */
+            output_picture(rel_st.tb(), fr, convert_time);
+            av_frame_unref(frame);
+            continue;
+        }
+
+        double filter_start = gettime();
         ret = av_buffersrc_add_frame(filt_in, frame);
         if (ret < 0)
             goto the_end;
 
         while (ret >= 0) {
-            FrameData *fd;
-
             ret = av_buffersink_get_frame_flags(filt_out, frame, 0);
             if (ret < 0) {
                 if (ret == AVERROR_EOF)
@@ -293,14 +609,10 @@ void VideoTrack::run()
                 break;
             }
 
-            fd = frame->opaque_ref ? (FrameData*)frame->opaque_ref->data : NULL;
-
-            const auto tb = av_buffersink_get_time_base(filt_out);
-            const auto frame_rate = av_buffersink_get_frame_rate(filt_out);
-            duration = (frame_rate.num && frame_rate.den ? av_q2d((AVRational){frame_rate.den, frame_rate.num}) : 0);
-            pts = (frame->pts == AV_NOPTS_VALUE) ? NAN : frame->pts * av_q2d(tb);
-
-            if(queue_picture(frame, pts, duration, fd ? fd->pkt_pos : -1, dec.pkt_serial))
+            const bool queued = output_picture(av_buffersink_get_time_base(filt_out), av_buffersink_get_frame_rate(filt_out),
+                                               isnan(filter_start) ? NAN : gettime() - filter_start);
+            filter_start = NAN;
+            if (!queued)
                 break;
 
             av_frame_unref(frame);
@@ -312,6 +624,10 @@ void VideoTrack::run()
             goto the_end;
     }
 the_end:
+    if (converter && converter->framesConverted() > 0)
+        av_log(NULL, AV_LOG_VERBOSE, "Pixel conversion: %d frames, %.2f ms per frame on average\n",
+               converter->framesConverted(), converter->avgTime() * 1000.0);
     avfilter_graph_free(&graph);
+    av_frame_free(&conv_frame);
     av_frame_free(&frame);
 }
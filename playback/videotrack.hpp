@@ -5,13 +5,38 @@
 #include "framequeue.hpp"
 #include "cavframe.h"
 #include "clock.hpp"
+#include "qoscontroller.hpp"
+#include "playeroptions.hpp"
+#include "pixelconverter.hpp"
 
 class VideoTrack : public AVTrack
 {
 private:
     FrameQueue<CAVFrame> frame_pool;
     std::vector<AVPixelFormat> supported_pix_fmts;
+    std::vector<AVColorSpace> supported_color_spaces;
     Clock clk;
+    QosController qos;
+
+    /*Early frame dropping. The master clock is published by the refresh loop as an offset to
+     * gettime(), NAN when the video is the master or paused*/
+    const bool early_drop;
+    std::atomic<double> master_offset = NAN;
+    std::atomic<double> upload_delay = 0.0;
+    double filter_delay = 0.0; /*decoder thread only*/
+    int early_drops_in_row = 0;
+    std::atomic<int> early_drops = 0;
+    /*Downscaling to the display size. The size is set by the refresh loop, the rest is decoder thread only*/
+    const bool display_downscale;
+    std::atomic<int> display_w = 0, display_h = 0;
+    int scale_src_w = 0, scale_src_h = 0;
+    int scale_w = 0, scale_h = 0; /*0 when the frames are kept at their size*/
+    double scale_changed_at = -INFINITY;
+
+    /*created once a frame needs it*/
+    std::unique_ptr<PixelConverter> converter;
+
+    std::atomic<double> flush_time = NAN; /*when the last flush was requested, to measure the seek latency*/
 
     AVFilterGraph* vgraph = nullptr;
     AVFilterContext* in_video_filter = nullptr, *out_video_filter = nullptr;
@@ -19,13 +44,19 @@ private:
 private:
     int get_video_frame(AVFrame *frame);
     int configure_video_filters(AVFilterGraph *graph, const char *vfilters, const AVFrame *frame);
-    int queue_picture(AVFrame *src_frame, double pts, double duration, int64_t pos, int serial);
+    int queue_picture(AVFrame *src_frame, double pts, double duration, int64_t pos, int serial,
+                      DisplayOrientation orientation);
+    void apply_qos_level();
+    bool is_late(const AVFrame *frame, double fallback_dur);
+    bool can_bypass_filters(const AVFrame *frame) const;
+    void update_display_scale(const AVFrame *frame);
 
     void run();
 
 public:
     VideoTrack() = delete;
-    VideoTrack(const CAVStream& st, std::condition_variable&, const std::vector<AVPixelFormat>&);
+    VideoTrack(const CAVStream& st, WakeupEvent&, const std::vector<AVPixelFormat>&, const std::vector<AVColorSpace>&,
+               const PlayerOptions& opts, const DecoderConfig& dec_cfg = {});
     ~VideoTrack();
 
     int framesAvailable();
@@ -42,8 +73,17 @@ public:
     double curPts() const;
     void updateClock(double pts);
     void setPauseStatus(bool p);
+    void reportLateDrop();
+    /*Refresh loop: the master clock the frames are synchronized to, NAN if none*/
+    void syncTo(double master_clock);
+    /*Refresh loop: time it took to upload a frame to the texture*/
+    void reportUploadTime(double t);
+    /*Refresh loop: size of the area the video is displayed in, in pixels*/
+    void setDisplaySize(int w, int h);
+    int earlyDrops() const;
+    const QosController& qosStats() const;
 
-    void flush();
+    void flush(double preroll_target = NAN);
 
 };
 
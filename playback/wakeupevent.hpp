@@ -0,0 +1,68 @@
+#ifndef WAKEUPEVENT_HPP
+#define WAKEUPEVENT_HPP
+
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+#include <QtGlobal>
+
+/* An auto-reset event the demuxer and presentation threads sleep on. Any thread may signal it; the signal
+ * costs two atomic operations unless the waiting thread is actually asleep. The waiter is
+ * expected to re-check its state after waking up, so signals don't carry any payload. */
+class WakeupEvent final
+{
+    Q_DISABLE_COPY_MOVE(WakeupEvent);
+private:
+    std::atomic_bool signalled = false, sleeping = false;
+    std::atomic<int> wakeup_count = 0;
+    std::mutex mutex;
+    std::condition_variable cond;
+
+public:
+    WakeupEvent() = default;
+
+    void signal()
+    {
+        signalled = true;
+        if (sleeping.load()) {
+            std::scoped_lock lck(mutex);
+            cond.notify_one();
+        }
+    }
+
+    /* Blocks until signal() is called. Returns immediately if the event
+     * was signalled since the last wait. */
+    void wait()
+    {
+        if (!signalled.exchange(false)) {
+            std::unique_lock lck(mutex);
+            sleeping = true;
+            cond.wait(lck, [this]{return signalled.load();});
+            sleeping = false;
+            signalled = false;
+        }
+        ++wakeup_count;
+    }
+
+    /* Same as wait(), but returns after timeout seconds at the latest. The deadline is on the
+     * steady clock, so the sleep is as precise as the timers of the system */
+    void waitFor(double timeout)
+    {
+        if (!signalled.exchange(false)) {
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(timeout);
+            std::unique_lock lck(mutex);
+            sleeping = true;
+            cond.wait_until(lck, deadline, [this]{return signalled.load();});
+            sleeping = false;
+            signalled = false;
+        }
+        ++wakeup_count;
+    }
+
+    /* Number of times the waiter was woken up, for diagnostics */
+    int wakeups() const {return wakeup_count.load();}
+};
+
+#endif // WAKEUPEVENT_HPP
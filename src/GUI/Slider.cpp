@@ -2,6 +2,8 @@
 
 #include <QMouseEvent>
 
+#include <algorithm>
+
 Slider::Slider(QWidget* parent, int stretch) : QSlider(Qt::Horizontal, parent) {
     static constexpr auto MIN_VAL = 1, MAX_VAL = 1000;
     auto sPolicy = sizePolicy();
@@ -21,13 +23,27 @@ void Slider::handleMouseEvt(QMouseEvent* evt){
 }
 
 void Slider::mousePressEvent(QMouseEvent* evt){
+    is_dragged = true;
     handleMouseEvt(evt);
     return QSlider::mousePressEvent(evt);
 }
 
 void Slider::mouseReleaseEvent(QMouseEvent* evt){
     handleMouseEvt(evt);
-    return QSlider::mouseReleaseEvent(evt);
+    QSlider::mouseReleaseEvent(evt);
+    is_dragged = false;
+    emit dragFinished(value());
+}
+
+void Slider::mouseMoveEvent(QMouseEvent* evt){
+    const auto x = evt->pos().x();
+    emit hovered(x, std::clamp(double(x)/width(), 0.0, 1.0));
+    return QSlider::mouseMoveEvent(evt);
+}
+
+void Slider::leaveEvent(QEvent* evt){
+    emit hoverLeft();
+    return QSlider::leaveEvent(evt);
 }
 
 void Slider::setPos(double percent){
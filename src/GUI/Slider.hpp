@@ -9,13 +9,21 @@ class Slider : public QSlider
 
     void mousePressEvent(QMouseEvent* evt) override;
     void mouseReleaseEvent(QMouseEvent* evt) override;
+    void mouseMoveEvent(QMouseEvent* evt) override;
+    void leaveEvent(QEvent* evt) override;
     void handleMouseEvt(QMouseEvent* evt);
 
-    bool is_being_updated = false;
+    bool is_being_updated = false, is_dragged = false;
 public:
     Slider(QWidget* parent = nullptr, int stretch = 0);
     void setPos(double percent);
     inline bool falseUpdate() const{return is_being_updated;}
+    inline bool isDragged() const{return is_dragged;}
+
+    Q_SIGNAL void dragFinished(int value);
+    /*The mouse is over the slider at x, pointing at percent of its range*/
+    Q_SIGNAL void hovered(int x, double percent);
+    Q_SIGNAL void hoverLeft();
 };
 
 #endif // SLIDER_HPP
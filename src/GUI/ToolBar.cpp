@@ -22,11 +22,38 @@ ToolBar::ToolBar(QWidget* parent) : QToolBar(parent){
     addWidget(vol_slider);
 
     connect(playback_slider, &Slider::valueChanged, this, [&](int val){
-        if(!playback_slider->falseUpdate())
+        if(playback_slider->falseUpdate())
+            return;
+        if(playback_slider->isDragged())
+            emit sigScrub(double(val)/playback_slider->maximum());
+        else
             emit sigSeek(double(val)/playback_slider->maximum());});
+    connect(playback_slider, &Slider::dragFinished, this, [&](int val){
+        emit sigScrubEnd(double(val)/playback_slider->maximum());});
+
+    thumbnail_popup = new QLabel(this, Qt::ToolTip);
+    thumbnail_popup->setAlignment(Qt::AlignHCenter | Qt::AlignBottom);
+    connect(playback_slider, &Slider::hovered, this, [&](int x, double percent){
+        hover_x = x;
+        if(playback_slider->isEnabled())
+            emit sigThumbnailRequest(percent);});
+    connect(playback_slider, &Slider::hoverLeft, thumbnail_popup, &QLabel::hide);
+}
+
+void ToolBar::showThumbnail(QImage img, double pos){
+    if(!playback_slider->underMouse() || !playback_slider->isEnabled())
+        return;
+    thumbnail_popup->setPixmap(QPixmap::fromImage(img));
+    thumbnail_popup->adjustSize();
+    const auto anchor = playback_slider->mapToGlobal(QPoint(hover_x, 0));
+    thumbnail_popup->move(anchor.x() - thumbnail_popup->width() / 2, anchor.y() - thumbnail_popup->height() - 4);
+    thumbnail_popup->show();
 }
 
 void ToolBar::updatePlaybackPos(double pos, double dur){
+    /*the slider follows the mouse while it is being dragged*/
+    if(playback_slider->isDragged())
+        return;
     if(!std::isnan(dur) && dur > 0){
         const auto pcent = pos/dur;
         playback_slider->setPos(pcent);
@@ -34,6 +61,7 @@ void ToolBar::updatePlaybackPos(double pos, double dur){
 }
 
 void ToolBar::setActive(bool active){
+    thumbnail_popup->hide();
     playback_slider->setPos(0);
     playback_slider->setEnabled(active);
 }
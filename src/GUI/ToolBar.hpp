@@ -4,17 +4,25 @@
 #include "Slider.hpp"
 
 #include <QToolBar>
+#include <QLabel>
 
 class ToolBar final: public QToolBar{
     Q_OBJECT
 
 private:
     Slider* vol_slider = nullptr, *playback_slider = nullptr;
+    QLabel* thumbnail_popup = nullptr;
+    int hover_x = 0;
 
 public:
     explicit ToolBar(QWidget* parent);
 
     Q_SIGNAL void sigSeek(double percent);
+    /*Emitted while the playback slider is being dragged, and once when it is released*/
+    Q_SIGNAL void sigScrub(double percent);
+    Q_SIGNAL void sigScrubEnd(double percent);
+    Q_SIGNAL void sigThumbnailRequest(double percent);
+    Q_SLOT void showThumbnail(QImage img, double pos);
     Q_SLOT void updatePlaybackPos(double pos, double dur);
     Q_SLOT void setActive(bool active);
 };